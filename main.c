@@ -17,9 +17,19 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "seekgzip.h"
 
 #define CHUNK 16384		 /* file input buffer size */
+#define RANGE_CHUNK 4194304	 /* bytes per read of a range, a few spans */
+#define POINT_SIZE 32816	 /* memory of an access point in an index */
+#define POINT_SPAN 1048576	 /* uncompressed bytes between access points */
+#define BUILD_BUDGET 1024	 /* default memory budget of a batch build (MiB) */
 
 static void seekgzip_perror(int ret)
 {
@@ -48,45 +58,615 @@ static void seekgzip_perror(int ret)
 	case SEEKGZIP_ZLIBERROR:
 		fprintf(stderr, "ERROR: An error occurred in zlib.\n");
 		break;
+	case SEEKGZIP_BUSY:
+		fprintf(stderr, "ERROR: Too many requests in flight.\n");
+		break;
+	}
+}
+
+static void verify_report(void *instance, off_t begin, off_t end, int error)
+{
+	fprintf(stderr, "CORRUPTED: %s: uncompressed range [%jd-%jd)\n",
+		(const char*)instance, (intmax_t)begin, (intmax_t)end);
+}
+
+static int verify_main(int argc, char *argv[])
+{
+	int i, ret, nthreads = 1;
+	const char *target = NULL;
+	seekgzip_t* zs;
+
+	for (i = 1;i < argc;++i) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else {
+			target = argv[i];
+		}
+	}
+	if (target == NULL) {
+		fprintf(stderr, "ERROR: No file to verify.\n");
+		return 1;
+	}
+
+	zs = seekgzip_open(target, 0);
+	if ((ret = seekgzip_error(zs)) != SEEKGZIP_SUCCESS) {
+		seekgzip_perror(ret);
+		seekgzip_close(zs);
+		return 1;
+	}
+	ret = seekgzip_verify(zs, nthreads, verify_report, (void*)target);
+	seekgzip_close(zs);
+	if (ret != SEEKGZIP_SUCCESS) {
+		seekgzip_perror(ret);
+		return 1;
+	}
+	printf("%s: OK\n", target);
+	return 0;
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int reindex_main(int argc, char *argv[])
+{
+	int i, ret, nthreads = 1;
+	off_t span = POINT_SPAN;
+	const char *target = NULL;
+	struct timespec start;
+	seekgzip_t* zs;
+
+	for (i = 1;i < argc;++i) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--span") == 0 && i + 1 < argc) {
+			span = (off_t)strtoull(argv[++i], NULL, 10);
+		} else {
+			target = argv[i];
+		}
+	}
+	if (target == NULL || span <= 0) {
+		fprintf(stderr, "ERROR: No file to reindex.\n");
+		return 1;
+	}
+
+	zs = seekgzip_open(target, 0);
+	if ((ret = seekgzip_error(zs)) != SEEKGZIP_SUCCESS) {
+		seekgzip_perror(ret);
+		seekgzip_close(zs);
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = seekgzip_reindex(zs, span, nthreads);
+	seekgzip_close(zs);
+	if (ret != SEEKGZIP_SUCCESS) {
+		seekgzip_perror(ret);
+		return 1;
+	}
+	printf("%s: reindexed with span %jd in %.1f s\n", target, (intmax_t)span, elapsed(&start));
+	return 0;
+}
+
+static int repack_main(int argc, char *argv[])
+{
+	int i, ret, nthreads = 1, bgzf = 0;
+	const char *target = NULL, *output = NULL;
+	struct timespec start;
+	seekgzip_t* zs;
+
+	for (i = 1;i < argc;++i) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--bgzf") == 0) {
+			bgzf = 1;
+		} else if (target == NULL) {
+			target = argv[i];
+		} else {
+			output = argv[i];
+		}
+	}
+	if (target == NULL || output == NULL) {
+		fprintf(stderr, "ERROR: No file to repack.\n");
+		return 1;
+	}
+
+	zs = seekgzip_open(target, 0);
+	if ((ret = seekgzip_error(zs)) != SEEKGZIP_SUCCESS) {
+		seekgzip_perror(ret);
+		seekgzip_close(zs);
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = seekgzip_repack(zs, output, nthreads, bgzf);
+	seekgzip_close(zs);
+	if (ret != SEEKGZIP_SUCCESS) {
+		seekgzip_perror(ret);
+		return 1;
+	}
+	printf("%s: repacked into %s in %.1f s\n", target, output, elapsed(&start));
+	return 0;
+}
+
+static void sample_output(void *instance, off_t offset, const void *record, size_t size)
+{
+	fwrite(record, 1, size, stdout);
+}
+
+static int sample_main(int argc, char *argv[])
+{
+	int i, ret, k = 10, nthreads = 1, delim = '\n';
+	unsigned long seed = 0;
+	const char *target = NULL;
+	seekgzip_t* zs;
+
+	for (i = 1;i < argc;++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			k = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			seed = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-z") == 0) {
+			delim = 0;
+		} else {
+			target = argv[i];
+		}
+	}
+	if (target == NULL) {
+		fprintf(stderr, "ERROR: No file to sample.\n");
+		return 1;
+	}
+
+	zs = seekgzip_open(target, 0);
+	if ((ret = seekgzip_error(zs)) != SEEKGZIP_SUCCESS) {
+		seekgzip_perror(ret);
+		seekgzip_close(zs);
+		return 1;
+	}
+	ret = seekgzip_sample(zs, k, seed, delim, nthreads, sample_output, NULL);
+	seekgzip_close(zs);
+	if (ret != SEEKGZIP_SUCCESS) {
+		seekgzip_perror(ret);
+		return 1;
+	}
+	return 0;
+}
+
+static void tar_write(void *instance, const void *data, size_t size)
+{
+	fwrite(data, 1, size, (FILE*)instance);
+}
+
+/* seekgzip tar-list FILE, seekgzip tar-extract FILE MEMBER */
+static int tar_main(int argc, char *argv[])
+{
+	int ret, type, extract = strcmp(argv[0], "tar-extract") == 0;
+	intmax_t i, n;
+	off_t offset, size;
+	const char *name;
+	seekgzip_t* zs;
+
+	if (argc != (extract ? 3 : 2)) {
+		fprintf(stderr, "ERROR: Wrong arguments for %s.\n", argv[0]);
+		return 1;
+	}
+	zs = seekgzip_open(argv[1], 0);
+	if ((ret = seekgzip_error(zs)) != SEEKGZIP_SUCCESS) {
+		seekgzip_perror(ret);
+		seekgzip_close(zs);
+		return 1;
+	}
+	if ((n = seekgzip_tar_count(zs)) == 0) {
+		fprintf(stderr, "ERROR: No tar members are recorded in the index of %s.\n", argv[1]);
+		seekgzip_close(zs);
+		return 1;
+	}
+
+	if (!extract) {
+		for (i = 0;i < n;++i) {
+			seekgzip_tar_member(zs, i, &name, &offset, &size, &type);
+			printf("%jd\t%jd\t%c\t%s\n", (intmax_t)offset, (intmax_t)size, type, name);
+		}
+		seekgzip_close(zs);
+		return 0;
+	}
+
+	if ((i = seekgzip_tar_find(zs, argv[2])) < 0) {
+		fprintf(stderr, "ERROR: %s is not in %s.\n", argv[2], argv[1]);
+		seekgzip_close(zs);
+		return 1;
+	}
+	if ((ret = seekgzip_tar_read(zs, i, tar_write, stdout)) != SEEKGZIP_SUCCESS)
+		seekgzip_perror(ret);
+	seekgzip_close(zs);
+	return ret == SEEKGZIP_SUCCESS ? 0 : 1;
+}
+
+/* seekgzip import FILE INDEX, seekgzip export [-f FORMAT] FILE OUTPUT */
+static int foreign_main(int argc, char *argv[])
+{
+	int i, ret, format = SEEKGZIP_FORMAT_GZIDX, import = strcmp(argv[0], "import") == 0;
+	const char *target = NULL, *path = NULL;
+	seekgzip_t* zs;
+
+	for (i = 1;i < argc;++i) {
+		if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			++i;
+			if (strcmp(argv[i], "gzi") == 0) {
+				format = SEEKGZIP_FORMAT_GZI;
+			} else if (strcmp(argv[i], "gzidx") == 0) {
+				format = SEEKGZIP_FORMAT_GZIDX;
+			} else {
+				fprintf(stderr, "ERROR: Unknown index format: %s\n", argv[i]);
+				return 1;
+			}
+		} else if (target == NULL) {
+			target = argv[i];
+		} else {
+			path = argv[i];
+		}
+	}
+	if (target == NULL || path == NULL) {
+		fprintf(stderr, "ERROR: No file or index given.\n");
+		return 1;
 	}
+
+	if (import) {
+		ret = seekgzip_import(target, path);
+	} else {
+		zs = seekgzip_open(target, 0);
+		if ((ret = seekgzip_error(zs)) == SEEKGZIP_SUCCESS)
+			ret = seekgzip_index_export(zs, path, format);
+		seekgzip_close(zs);
+	}
+	if (ret != SEEKGZIP_SUCCESS) {
+		seekgzip_perror(ret);
+		return 1;
+	}
+	return 0;
+}
+
+/* A file of a batch build. */
+struct job {
+	char                  *path;
+	off_t                  size;
+	size_t                 memory;		/* estimated peak memory of its build */
+	int                    started;
+};
+
+struct batch {
+	struct job            *jobs;
+	size_t                 n, size;
+	size_t                 first;		/* jobs before this one are started */
+	size_t                 done;
+	size_t                 memory;		/* estimated memory of running builds */
+	size_t                 budget;
+	int                    running;
+	int                    built, skipped, failed;
+	off_t                  bytes;		/* compressed bytes indexed */
+	struct timespec        start;
+	pthread_mutex_t        mutex;
+	pthread_cond_t         cond;
+};
+
+
+/* The index adds an access point for every POINT_SPAN bytes of uncompressed
+   data: a small entry in the point list, which grows by doubling, and a 32K
+   window in the window arena, which grows in blocks of up to 64 windows that
+   are never copied.  POINT_SIZE covers both; the unused tail of the last
+   block is left out.  The uncompressed size is guessed from the gzip trailer
+   (modulo 4 GiB) or a 1:3 compression ratio, whichever is larger. */
+static size_t estimate_memory(const char *path, off_t size)
+{
+	int fd;
+	unsigned char b[4];
+	uintmax_t unpacked = (uintmax_t)size * 3;
+
+	if ((fd = open(path, O_RDONLY)) != -1) {
+		if (18 <= size && pread(fd, b, 2, 0) == 2 && b[0] == 0x1f && b[1] == 0x8b &&
+			pread(fd, b, 4, size - 4) == 4) {
+			uintmax_t isize = b[0] | (b[1] << 8) | (b[2] << 16) | ((uintmax_t)b[3] << 24);
+			if (unpacked < isize)
+				unpacked = isize;
+		}
+		close(fd);
+	}
+	return (size_t)((unpacked / POINT_SPAN + 1) * POINT_SIZE);
+}
+
+static int add_job(struct batch *b, const char *path, off_t size)
+{
+	if (b->n == b->size) {
+		struct job *jobs;
+		size_t n = b->size ? b->size * 2 : 64;
+		if( (jobs = (struct job*)realloc(b->jobs, sizeof(struct job) * n)) == NULL)
+			return -1;
+		b->jobs = jobs;
+		b->size = n;
+	}
+	if( (b->jobs[b->n].path = strdup(path)) == NULL)
+		return -1;
+	b->jobs[b->n].size = size;
+	b->jobs[b->n].memory = estimate_memory(path, size);
+	b->jobs[b->n].started = 0;
+	b->n++;
+	return 0;
+}
+
+/* Add a file, or with recursive the *.gz files under a directory. */
+static int add_path(struct batch *b, const char *path, int recursive)
+{
+	int ret = 0;
+	size_t len;
+	char *child;
+	struct stat st;
+	struct dirent *e;
+	DIR *dir;
+
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "ERROR: %s: No such file.\n", path);
+		b->failed++;
+		return 0;
+	}
+	if (!S_ISDIR(st.st_mode))
+		return add_job(b, path, st.st_size);
+	if (!recursive) {
+		fprintf(stderr, "ERROR: %s: Is a directory (use -r).\n", path);
+		b->failed++;
+		return 0;
+	}
+
+	if( (dir = opendir(path)) == NULL)
+		return 0;
+	while (ret == 0 && (e = readdir(dir)) != NULL) {
+		if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+			continue;
+		if( (child = (char*)malloc(strlen(path) + strlen(e->d_name) + 2)) == NULL){
+			ret = -1;
+			break;
+		}
+		sprintf(child, "%s/%s", path, e->d_name);
+		len = strlen(child);
+		if (stat(child, &st) == 0 && (S_ISDIR(st.st_mode) ||
+			(3 < len && strcmp(child + len - 3, ".gz") == 0)))
+			ret = add_path(b, child, recursive);
+		free(child);
+	}
+	closedir(dir);
+	return ret;
+}
+
+static int compare_jobs(const void *x, const void *y)
+{
+	const struct job *a = (const struct job*)x, *b = (const struct job*)y;
+	return (a->size < b->size) - (b->size < a->size);
+}
+
+/* Build the index of one file unless a valid one exists; a build whose
+   index could not be written counts as a failure. */
+static int build_one(const char *path, int *skipped)
+{
+	int ret;
+	off_t unpacked, packed;
+	seekgzip_t *zs;
+
+	*skipped = 0;
+	if (seekgzip_peek(path, &unpacked, &packed) == SEEKGZIP_SUCCESS) {
+		*skipped = 1;
+		return SEEKGZIP_SUCCESS;
+	}
+
+	zs = seekgzip_open(path, 0);
+	ret = seekgzip_error(zs);
+	seekgzip_close(zs);
+	if (ret == SEEKGZIP_SUCCESS && seekgzip_peek(path, &unpacked, &packed) != SEEKGZIP_SUCCESS)
+		ret = SEEKGZIP_WRITEERROR;
+	return ret;
+}
+
+/* Take the largest pending file whose build fits in the memory budget; a
+   file larger than the whole budget runs once nothing else does. */
+static void *build_worker(void *arg)
+{
+	int ret, skipped;
+	size_t i;
+	double t;
+	struct batch *b = (struct batch*)arg;
+	struct job *job;
+
+	pthread_mutex_lock(&b->mutex);
+	for (;;) {
+		while (b->first < b->n && b->jobs[b->first].started)
+			b->first++;
+		if (b->n <= b->first)
+			break;
+
+		job = NULL;
+		for (i = b->first;i < b->n;++i) {
+			if (!b->jobs[i].started &&
+				(b->running == 0 || b->memory + b->jobs[i].memory <= b->budget)) {
+				job = &b->jobs[i];
+				break;
+			}
+		}
+		if (job == NULL) {
+			pthread_cond_wait(&b->cond, &b->mutex);
+			continue;
+		}
+
+		job->started = 1;
+		b->memory += job->memory;
+		b->running++;
+		pthread_mutex_unlock(&b->mutex);
+
+		ret = build_one(job->path, &skipped);
+
+		pthread_mutex_lock(&b->mutex);
+		b->memory -= job->memory;
+		b->running--;
+		b->done++;
+		if (ret != SEEKGZIP_SUCCESS) {
+			b->failed++;
+			fprintf(stderr, "[%zu/%zu] %s: ", b->done, b->n, job->path);
+			seekgzip_perror(ret);
+		} else if (skipped) {
+			b->skipped++;
+			fprintf(stderr, "[%zu/%zu] %s: index is up to date\n", b->done, b->n, job->path);
+		} else {
+			b->built++;
+			b->bytes += job->size;
+			t = elapsed(&b->start);
+			fprintf(stderr, "[%zu/%zu] %s: indexed (%.1f MB/s)\n", b->done, b->n, job->path,
+				0 < t ? b->bytes / t / 1e6 : 0.);
+		}
+		pthread_cond_broadcast(&b->cond);
+	}
+	pthread_mutex_unlock(&b->mutex);
+	return NULL;
+}
+
+static int build_main(int argc, char *argv[])
+{
+	int i, nthreads = 1, recursive = 0, ret = 0;
+	size_t k, len;
+	char line[4096];
+	double t;
+	pthread_t *threads;
+	struct batch b;
+
+	memset(&b, 0, sizeof(b));
+	b.budget = (size_t)BUILD_BUDGET << 20;
+	pthread_mutex_init(&b.mutex, NULL);
+	pthread_cond_init(&b.cond, NULL);
+
+	for (i = 1;i < argc;++i) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			b.budget = (size_t)strtoull(argv[++i], NULL, 10) << 20;
+		} else if (strcmp(argv[i], "-r") == 0) {
+			recursive = 1;
+		} else if (strcmp(argv[i], "-") == 0) {
+			// Read a list of files from STDIN, one per line.
+			while (fgets(line, sizeof(line), stdin) != NULL) {
+				line[strcspn(line, "\r\n")] = 0;
+				if (*line && add_path(&b, line, recursive) != 0)
+					goto out_of_memory;
+			}
+		} else if (add_path(&b, argv[i], recursive) != 0) {
+			goto out_of_memory;
+		}
+	}
+	if (b.n == 0) {
+		fprintf(stderr, "ERROR: No file to index.\n");
+		return 1;
+	}
+	if (nthreads <= 0)
+		nthreads = 1;
+	if (b.n < (size_t)nthreads)
+		nthreads = (int)b.n;
+
+	qsort(b.jobs, b.n, sizeof(struct job), compare_jobs);
+
+	if( (threads = (pthread_t*)malloc(sizeof(pthread_t) * nthreads)) == NULL)
+		goto out_of_memory;
+	clock_gettime(CLOCK_MONOTONIC, &b.start);
+	for (len = 0;len < (size_t)nthreads;++len) {
+		if (pthread_create(&threads[len], NULL, build_worker, &b) != 0)
+			break;
+	}
+	if (len == 0)
+		build_worker(&b);
+	for (k = 0;k < len;++k)
+		pthread_join(threads[k], NULL);
+	free(threads);
+
+	t = elapsed(&b.start);
+	printf("%zu files: %d indexed, %d up to date, %d failed; %.1f MB in %.1f s (%.1f MB/s)\n",
+		b.n, b.built, b.skipped, b.failed, b.bytes / 1e6, t, 0 < t ? b.bytes / t / 1e6 : 0.);
+	ret = b.failed ? 1 : 0;
+
+	for (k = 0;k < b.n;++k)
+		free(b.jobs[k].path);
+	free(b.jobs);
+	return ret;
+
+out_of_memory:
+	seekgzip_perror(SEEKGZIP_OUTOFMEMORY);
+	return 1;
 }
 
 int main(int argc, char *argv[])
 {
 	int ret = 0;
 
+	if (2 <= argc && strcmp(argv[1], "verify") == 0) {
+		return verify_main(argc - 1, argv + 1);
+	}
+	if (2 <= argc && (strcmp(argv[1], "import") == 0 || strcmp(argv[1], "export") == 0)) {
+		return foreign_main(argc - 1, argv + 1);
+	}
+	if (2 <= argc && (strcmp(argv[1], "tar-list") == 0 || strcmp(argv[1], "tar-extract") == 0)) {
+		return tar_main(argc - 1, argv + 1);
+	}
+	if (2 <= argc && strcmp(argv[1], "sample") == 0) {
+		return sample_main(argc - 1, argv + 1);
+	}
+	if (2 <= argc && strcmp(argv[1], "repack") == 0) {
+		return repack_main(argc - 1, argv + 1);
+	}
+	if (2 <= argc && strcmp(argv[1], "reindex") == 0) {
+		return reindex_main(argc - 1, argv + 1);
+	}
+	if (3 <= argc && strcmp(argv[1], "-b") == 0) {
+		return build_main(argc - 1, argv + 1);
+	}
+
 	if (argc != 3) {
 		printf("This utility manages an index for random (seekable) access to a gzip file.\n");
 		printf("USAGE:\n");
-		printf("	%s -b <FILE>\n", argv[0]);
-		printf("		Build an index file \"$FILE.idx\" for the gzip file $FILE.\n");
+		printf("	%s -b [-j N] [-m MIB] [-r] <FILE>... | -\n", argv[0]);
+		printf("		Build index files \"$FILE.idx\" for the gzip files using N threads\n");
+		printf("		within MIB of memory; -r descends into directories, - reads a list\n");
+		printf("		of files from STDIN.\n");
 		printf("	%s <FILE> [BEGIN-END]\n", argv[0]);
 		printf("		Output the content of the gzip file $FILE of offset range [BEGIN-END].\n");
+		printf("	%s verify [-j N] <FILE>\n", argv[0]);
+		printf("		Check the CRCs of the gzip file $FILE using N threads.\n");
+		printf("	%s reindex [--span S] [-j N] <FILE>\n", argv[0]);
+		printf("		Rebuild the index of $FILE with access points every S bytes.\n");
+		printf("	%s repack [-j N] [--bgzf] <FILE> <OUTPUT>\n", argv[0]);
+		printf("		Rewrite $FILE as independent gzip members, one per access point.\n");
+		printf("	%s sample [-n K] [-s SEED] [-j N] [-z] <FILE>\n", argv[0]);
+		printf("		Output K random lines (NUL-terminated records with -z) of $FILE.\n");
+		printf("	%s export [-f gzi|gzidx] <FILE> <OUTPUT>\n", argv[0]);
+		printf("		Write the index of $FILE for bgzip or indexed_gzip.\n");
+		printf("	%s import <FILE> <INDEX>\n", argv[0]);
+		printf("		Convert a bgzip or indexed_gzip index into the index of $FILE.\n");
+		printf("	%s tar-list <FILE>\n", argv[0]);
+		printf("		List the members of the tar archive $FILE (offset, size, type, name).\n");
+		printf("	%s tar-extract <FILE> <MEMBER>\n", argv[0]);
+		printf("		Output the data of the member $MEMBER of the tar archive $FILE.\n");
 		return 0;
 
-	} else if (strcmp(argv[1], "-b") == 0) {
-		const char *target = argv[2];
-		
-		printf("Building an index: %s.idx\n", target);
-		printf("Filesize up to: %d bit\n", (int)sizeof(off_t) * 8);
-		printf("WARNING: if program fail to write index to file, it would silently ignore that\n");
-
-		seekgzip_t* zs = seekgzip_open(target, 0);
-		if ((ret = seekgzip_error(zs)) != SEEKGZIP_SUCCESS) {
-			seekgzip_perror(ret);
-			return 1;
-		}
-		seekgzip_close(zs);
-	return 0;
-
 	} else {
-		char *arg = argv[2], *p = NULL;
+		char *arg = argv[2], *p = NULL, *buffer;
 		off_t begin = 0, end = (off_t)-1;
 		seekgzip_t* zs = seekgzip_open(argv[1], 0);
 		if (zs == NULL || seekgzip_error(zs) != SEEKGZIP_SUCCESS) {
 			fprintf(stderr, "ERROR: Failed to open the index file.\n");
 			return 1;
 		}
+		// Every read decodes from the access point before it, so read the
+		// range in pieces of several spans rather than small buffers.
+		if( (buffer = (char*)malloc(RANGE_CHUNK)) == NULL){
+			seekgzip_perror(SEEKGZIP_OUTOFMEMORY);
+			seekgzip_close(zs);
+			return 1;
+		}
 
 		p = strchr(arg, '-');
 		if (p == NULL) {
@@ -108,10 +688,9 @@ int main(int argc, char *argv[])
 
 		while (begin < end) {
 			int read;
-			char buffer[CHUNK];
 			off_t size = (end - begin);
-			if (CHUNK < size) {
-				size = CHUNK;
+			if (RANGE_CHUNK < size) {
+				size = RANGE_CHUNK;
 			}
 			read = seekgzip_read(zs, buffer, (int)size);
 			if (0 < read) {
@@ -128,6 +707,7 @@ int main(int argc, char *argv[])
 			}
 		}
 	
+		free(buffer);
 		seekgzip_close(zs);
 		return ret;
 	}
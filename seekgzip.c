@@ -18,7 +18,9 @@
 #include <stdint.h>
 #include <string.h>
 #include <zlib.h>
+#include <pthread.h>
 #include <utime.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include "seekgzip.h"
 
@@ -32,16 +34,21 @@
 
 int  seekgzip_index_alloc(seekgzip_t *sz);
 void seekgzip_index_free(seekgzip_t *sz);
+int  seekgzip_index_save(seekgzip_t *sz);
+static char *get_index_file(const char *target);
 
 struct tag_seekgzip {
-	char                  *path_data;
 	char                  *path_index;
-	FILE                  *fp;
+	seekgzip_source_t     *src;
 	struct access         *index;
 	off_t                  offset;
 	off_t                  totin;
 	off_t                  totout;
 	int                    errorcode;
+	int                    flags;
+	struct readahead      *readahead;
+	struct cache          *cache;
+	struct hot            *hot;
 };
 
 /*===== Begin of the portion of zran.c ===== {{{*/
@@ -103,85 +110,687 @@ struct tag_seekgzip {
 struct point {
 	off_t out;		  /* corresponding offset in uncompressed data */
 	off_t in;		   /* offset in input file of first full byte */
-	int bits;		   /* number of bits (1-7) from byte at in - 1, or 0 */
-	unsigned char window[WINSIZE];  /* preceding 32K of uncompressed data */
+	int bits;		   /* number of bits (1-7) from byte at in - 1, or 0,
+				      or MEMBER_START for a gzip member at in */
+	uint32_t crc;		   /* CRC-32 of the data up to the next point */
+	unsigned char *window;	   /* preceding 32K of uncompressed data, or NULL
+				      for MEMBER_START */
+};
+
+/* a block of windows; windows never move once handed out */
+struct chunk {
+	struct chunk *next;
+	uintmax_t used;			   /* windows handed out */
+	uintmax_t size;			   /* windows in the block */
 };
 
 /* access point list */
 struct access {
 	uintmax_t nelements;		   /* number of list entries filled in */
 	uintmax_t allocated;		   /* number of list entries allocated */
+	int crc;			   /* whether the points carry span CRCs */
+	int members;			   /* whether the stream has several gzip members */
 	struct point *list; /* allocated list */
+	off_t *out;			   /* list[i].out, dense for findpoint() */
+	struct chunk *windows;		   /* storage of the windows, newest first */
+	struct tar *tar;		   /* members of a tar stream, or NULL */
 };
 
-/* Add an entry to the access point list.  If out of memory, deallocate the
-   existing list and return NULL. */
+/* The point entries are small and kept in a growing array, together with a
+   dense array of their uncompressed offsets that findpoint() searches.  The
+   32K windows live apart in blocks of up to WINDOW_CHUNK windows, so growing
+   the list never copies them. */
+#define WINDOW_CHUNK 64
+
+/* An access point at the start of a gzip member needs no window. */
+#define MEMBER_START -1
+
+/* Called when inflate reached the end of a gzip member: if another member
+   starts at input offset next, reset strm to decode it and return 1. */
+static int next_member(seekgzip_source_t *in, z_stream *strm, off_t next)
+{
+	unsigned char magic[2];
+
+	if (in->read_at(in, magic, 2, next) != 2 || magic[0] != 0x1f || magic[1] != 0x8b)
+		return 0;
+	return inflateReset2(strm, 31) == Z_OK;
+}
+
+/* Prepare strm to decode from access point here: a member start is decoded
+   as gzip, anything else as raw deflate primed with the bits at in - 1 and
+   the window.  *pos is set to the next input offset to read. */
+static int start_point(seekgzip_source_t *in, z_stream *strm, struct point *here,
+	off_t *pos, unsigned char *input)
+{
+	int ret;
+	ssize_t got;
+
+	strm->zalloc = Z_NULL;
+	strm->zfree = Z_NULL;
+	strm->opaque = Z_NULL;
+	strm->avail_in = 0;
+	strm->next_in = Z_NULL;
+	if (here->bits == MEMBER_START) {
+		*pos = here->in;
+		return inflateInit2(strm, 31);	  /* gzip member */
+	}
+
+	ret = inflateInit2(strm, -15);		 /* raw inflate */
+	if (ret != Z_OK)
+		return ret;
+	*pos = here->in;
+	if (here->bits) {
+		got = in->read_at(in, input, 1, here->in - 1);
+		if (got != 1) {
+			(void)inflateEnd(strm);
+			return got < 0 ? Z_ERRNO : Z_DATA_ERROR;
+		}
+		(void)inflatePrime(strm, here->bits, input[0] >> (8 - here->bits));
+	}
+	(void)inflateSetDictionary(strm, here->window, WINSIZE);
+	return Z_OK;
+}
+
+/* Resize the list (and offsets) to n entries; on failure both are left as
+   they were and -1 is returned. */
+static int access_resize(struct access *index, uintmax_t n)
+{
+	struct point *list;
+	off_t *out;
+
+	if (SIZE_MAX / sizeof(struct point) < n)
+		return -1;
+	if( (list = (struct point*)realloc(index->list, sizeof(struct point) * (n ? n : 1))) == NULL)
+		return -1;
+	index->list = list;
+	if( (out = (off_t*)realloc(index->out, sizeof(off_t) * (n ? n : 1))) == NULL)
+		return -1;
+	index->out = out;
+	index->allocated = n;
+	return 0;
+}
+
+/* Start a new block for the next n windows, e.g., when the number of points
+   to come is known. */
+static int window_reserve(struct access *index, uintmax_t n)
+{
+	struct chunk *c;
+
+	if (SIZE_MAX / WINSIZE - 1 < n)
+		return -1;
+	c = (struct chunk*)malloc(sizeof(struct chunk) + (size_t)WINSIZE * n);
+	if (c == NULL)
+		return -1;
+	c->used = 0;
+	c->size = n;
+	c->next = index->windows;
+	index->windows = c;
+	return 0;
+}
+
+/* Hand out a window, in blocks that grow with the list up to WINDOW_CHUNK. */
+static unsigned char *window_alloc(struct access *index)
+{
+	struct chunk *c = index->windows;
+
+	if (c == NULL || c->used == c->size) {
+		if (window_reserve(index, index->nelements < 1 ? 1 :
+			index->nelements < WINDOW_CHUNK ? index->nelements : WINDOW_CHUNK) != 0)
+			return NULL;
+		c = index->windows;
+	}
+	return (unsigned char*)(c + 1) + (size_t)WINSIZE * c->used++;
+}
+
+static void tar_free(struct tar *t);
+
+static void access_free(struct access *index)
+{
+	struct chunk *c;
+
+	if (index != NULL) {
+		tar_free(index->tar);
+		while ((c = index->windows) != NULL) {
+			index->windows = c->next;
+			free(c);
+		}
+		free(index->list);
+		free(index->out);
+		free(index);
+	}
+}
+
+/* Add an entry to the access point list.  If out of memory, return NULL and
+   leave the list as it was. */
 static struct access *addpoint(struct access *index, int bits,
 	off_t in, off_t out, unsigned left, unsigned char *window)
 {
 	struct point *next;
 
 	/* if list is full, make it bigger */
-	if (index->nelements == index->allocated) {
-		index->allocated = index->allocated != 0 ? index->allocated : 1; 
-		index->allocated <<= 1;
-		index->list = (struct point*)realloc(index->list, sizeof(struct point) * index->allocated);
-		if (index->list == NULL)
+	if (index->nelements == index->allocated &&
+		access_resize(index, index->allocated ? index->allocated << 1 : 2) != 0)
 		return NULL;
-	}
 
 	/* fill in entry and increment how many we have */
 	next = index->list + index->nelements;
 	next->bits = bits;
 	next->in = in;
 	next->out = out;
-	if (left)
-		memcpy(next->window, window + WINSIZE - left, left);
-	if (left < WINSIZE)
-		memcpy(next->window + left, window, WINSIZE - left);
-	index->nelements++;
+	next->crc = 0;
+	next->window = NULL;
+	if (bits != MEMBER_START) {
+		if( (next->window = window_alloc(index)) == NULL)
+			return NULL;
+		if (left)
+			memcpy(next->window, window + WINSIZE - left, left);
+		if (left < WINSIZE)
+			memcpy(next->window + left, window, WINSIZE - left);
+	}
+	index->out[index->nelements++] = out;
 
-	/* return list, possibly reallocated */
+	/* return list */
 	return index;
 }
 
+/* Replace the points of index with copies of the n points at list, whose
+   windows may belong to other indexes. */
+static int access_replace(struct access *index, const struct point *list, uintmax_t n)
+{
+	uintmax_t i, windows = 0;
+	struct access *fresh, old;
+
+	for (i = 0;i < n;++i)
+		windows += list[i].bits != MEMBER_START;
+	if( (fresh = (struct access*)calloc(1, sizeof(struct access))) == NULL)
+		return -1;
+	if (access_resize(fresh, n) != 0 || (windows && window_reserve(fresh, windows) != 0)) {
+		access_free(fresh);
+		return -1;
+	}
+	for (i = 0;i < n;++i) {
+		if (addpoint(fresh, list[i].bits, list[i].in, list[i].out, 0, list[i].window) == NULL) {
+			access_free(fresh);
+			return -1;
+		}
+		fresh->list[i].crc = list[i].crc;
+	}
+
+	/* swap the storage, keeping the flags and members of index */
+	old = *index;
+	*index = *fresh;
+	index->crc = old.crc;
+	index->members = old.members;
+	index->tar = old.tar;
+	old.tar = NULL;
+	*fresh = old;
+	access_free(fresh);
+	return 0;
+}
+
 #ifdef  SEEKGZIP_OPTIMIZATION
+/* The last point at or before offset: a binary search over the dense
+   offsets that halves the range without branching on the comparison. */
 struct point *findpoint(struct access *index, off_t offset)
 {
-	int half, len = index->nelements;
-	struct point *first = &index->list[0], *middle;
+	uintmax_t half, len = index->nelements;
+	const off_t *first = index->out;
 
-	/* equivalent to std::upper_bound() */
-	while (0 < len) {
-		half = (len >> 1);
-		middle = first + half;
-		if (offset < middle->out) {
-			len = half;
+	if (len == 0 || offset < first[0])
+		return NULL;
+	while (1 < len) {
+		half = len >> 1;
+		first = first[half] <= offset ? first + half : first;
+		len -= half;
+	}
+	return &index->list[first - index->out];
+}
+#endif/*SEEKGZIP_OPTIMIZATION*/
+
+/*===== CRC-32 ===== {{{*/
+
+/* crc32_fast() computes the same CRC-32 as zlib's crc32(), but folds runs of
+   16-byte blocks with carry-less multiplication when the CPU supports it
+   (Gopal et al., "Fast CRC Computation for Generic Polynomials Using
+   PCLMULQDQ Instruction", Intel, 2009).  The tail, and everything on other
+   CPUs, goes through zlib. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SEEKGZIP_PCLMUL
+
+/* Fold len bytes (len >= 64, a multiple of 16) into the raw CRC register. */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	/* bit-reflected constants for the gzip polynomial */
+	static const uint64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0, 0x00ccaa009e };
+	static const uint64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124, 0x0000000000 };
+	static const uint64_t poly[2] __attribute__((aligned(16))) = { 0x01db710641, 0x01f7011641 };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	x0 = _mm_load_si128((const __m128i*)k1k2);
+	buf += 64;
+	len -= 64;
+
+	/* fold four lanes of 16 bytes in parallel */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(buf + 0x30)));
+		buf += 64;
+		len -= 64;
+	}
+
+	/* fold the lanes into one */
+	x0 = _mm_load_si128((const __m128i*)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* single folds of the remaining 16-byte blocks */
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i*)buf);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	/* fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i*)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static int pclmul;
+static pthread_once_t pclmul_once = PTHREAD_ONCE_INIT;
+
+static void pclmul_detect(void)
+{
+	pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+#endif/*SEEKGZIP_PCLMUL*/
+
+static uLong crc32_fast(uLong crc, const unsigned char *buf, size_t len)
+{
+#ifdef  SEEKGZIP_PCLMUL
+	size_t chunk;
+
+	pthread_once(&pclmul_once, pclmul_detect);
+	if (pclmul && len >= 64) {
+		chunk = len & ~(size_t)15;
+		crc = ~crc32_pclmul(~(uint32_t)crc, buf, chunk) & 0xffffffffUL;
+		buf += chunk;
+		len -= chunk;
+	}
+#endif/*SEEKGZIP_PCLMUL*/
+	while (len > 0) {
+		uInt n = len < 0x40000000 ? (uInt)len : 0x40000000;
+		crc = crc32(crc, buf, n);
+		buf += n;
+		len -= n;
+	}
+	return crc;
+}
+
+/*===== End of CRC-32 ===== }}}*/
+
+/*===== Tar members ===== {{{*/
+
+/* When the uncompressed stream is a tar archive, build_index() passes the
+   data through tar_scan(), which follows the 512-byte headers and records
+   the name, type, size and data offset of every member, so that a member
+   can later be read with one decode from the access point before it.  GNU
+   long names ('L') and pax "path" and "size" records ('x') apply to the
+   member after them.  Scanning stops at the end of the archive or at the
+   first header with a bad checksum; if the stream does not start with a
+   tar header, nothing is recorded. */
+
+#define TAR_BLOCK 512
+#define TAR_EXTENDED 65536		/* largest long name or pax header read */
+
+struct tar_member {
+	char *name;
+	off_t offset;			/* uncompressed offset of the data */
+	off_t size;
+	int type;			/* typeflag, '0' for a regular file */
+};
+
+struct tar {
+	uintmax_t n;
+	uintmax_t allocated;
+	struct tar_member *members;
+};
+
+struct tar_scan {
+	struct tar *tar;		/* NULL once scanning has stopped */
+	off_t header;			/* offset of the next header */
+	unsigned fill;			/* bytes of it in block */
+	unsigned char block[TAR_BLOCK];
+	int type;			/* of the extended header being read */
+	char *data;			/* its data, or NULL */
+	size_t want, have;
+	char *name;			/* name of the next member, or NULL */
+	off_t size;			/* size of the next member, or -1 */
+};
+
+static void tar_free(struct tar *t)
+{
+	uintmax_t i;
+
+	if (t != NULL) {
+		for (i = 0;i < t->n;++i)
+			free(t->members[i].name);
+		free(t->members);
+		free(t);
+	}
+}
+
+/* A numeric field: octal digits, or base-256 if the high bit is set. */
+static off_t tar_number(const unsigned char *p, int len)
+{
+	int i;
+	off_t v = 0;
+
+	if (p[0] & 0x80) {
+		v = p[0] & 0x3f;
+		for (i = 1;i < len;++i) {
+			if (((off_t)1 << (sizeof(off_t) * 8 - 9)) <= v)
+				return -1;
+			v = (v << 8) | p[i];
+		}
+		return (p[0] & 0x40) ? -1 : v;
+	}
+	for (i = 0;i < len && p[i] == ' ';++i)
+		;
+	for (;i < len && '0' <= p[i] && p[i] <= '7';++i) {
+		if (((off_t)1 << (sizeof(off_t) * 8 - 4)) <= v)
+			return -1;
+		v = v * 8 + (p[i] - '0');
+	}
+	return v;
+}
+
+static int tar_checksum(const unsigned char *b)
+{
+	int i;
+	off_t sum = 0;
+
+	for (i = 0;i < TAR_BLOCK;++i)
+		sum += (148 <= i && i < 156) ? ' ' : b[i];
+	return sum == tar_number(b + 148, 8);
+}
+
+static char *tar_strndup(const char *p, size_t len)
+{
+	char *s;
+	const char *end = (const char*)memchr(p, 0, len);
+
+	if (end != NULL)
+		len = end - p;
+	if( (s = (char*)malloc(len + 1)) == NULL)
+		return NULL;
+	memcpy(s, p, len);
+	s[len] = 0;
+	return s;
+}
+
+/* Apply a long name or the "path" and "size" records of a pax header. */
+static void tar_extended(struct tar_scan *s)
+{
+	char *p = s->data, *end = s->data + s->have, *eq;
+	long len;
+
+	s->data[s->have] = 0;
+	if (s->type == 'L') {
+		free(s->name);
+		s->name = tar_strndup(p, s->have);
+		return;
+	}
+
+	/* records of the form "<length> <key>=<value>\n" */
+	while (p < end) {
+		len = strtol(p, &eq, 10);
+		if (len <= 0 || end - p < len || p[len - 1] != '\n')
+			break;
+		p[len - 1] = 0;
+		if( (eq = strchr(eq, ' ')) != NULL){
+			eq++;
+			if (strncmp(eq, "path=", 5) == 0) {
+				free(s->name);
+				s->name = tar_strndup(eq + 5, len);
+			} else if (strncmp(eq, "size=", 5) == 0) {
+				s->size = (off_t)strtoll(eq + 5, NULL, 10);
+			}
+		}
+		p += len;
+	}
+}
+
+/* Handle the header in s->block; clears s->tar to stop. */
+static void tar_header(struct tar_scan *s)
+{
+	const unsigned char *b = s->block;
+	struct tar_member *m;
+	off_t size;
+	int type;
+	size_t len;
+
+	if (s->data != NULL) {
+		tar_extended(s);
+		free(s->data);
+		s->data = NULL;
+	}
+	if (!tar_checksum(b) || (size = tar_number(b + 124, 12)) < 0) {
+		s->tar = NULL;
+		return;
+	}
+	type = b[156] ? b[156] : '0';
+
+	if (type == 'L' || type == 'x') {
+		s->type = type;
+		s->want = (size_t)(size < TAR_EXTENDED ? size : 0);
+		s->have = 0;
+		if (s->want && (s->data = (char*)malloc(s->want + 1)) == NULL) {
+			s->tar = NULL;
+			return;
+		}
+	} else if (type != 'g') {
+		if (0 <= s->size)
+			size = s->size;
+		if (s->tar->n == s->tar->allocated) {
+			s->tar->allocated = s->tar->allocated ? s->tar->allocated * 2 : 64;
+			m = (struct tar_member*)realloc(s->tar->members, sizeof(struct tar_member) * s->tar->allocated);
+			if (m == NULL) {
+				s->tar = NULL;
+				return;
+			}
+			s->tar->members = m;
+		}
+		m = &s->tar->members[s->tar->n];
+		if (s->name != NULL) {
+			m->name = s->name;
+			s->name = NULL;
+		} else if (memcmp(b + 257, "ustar", 6) == 0 && b[345]) {
+			/* ustar splits long names into prefix and name */
+			char *prefix = tar_strndup((const char*)b + 345, 155);
+			char *name = tar_strndup((const char*)b, 100);
+			len = prefix != NULL && name != NULL ? strlen(prefix) + strlen(name) + 2 : 0;
+			if (len && (m->name = (char*)malloc(len)) != NULL)
+				snprintf(m->name, len, "%s/%s", prefix, name);
+			else
+				m->name = NULL;
+			free(prefix);
+			free(name);
+		} else {
+			m->name = tar_strndup((const char*)b, 100);
+		}
+		if (m->name == NULL) {
+			s->tar = NULL;
+			return;
+		}
+		m->offset = s->header + TAR_BLOCK;
+		m->size = size;
+		m->type = type;
+		s->tar->n++;
+		s->size = -1;
+	}
+	s->header += TAR_BLOCK + (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+}
+
+/* Feed len bytes of uncompressed data starting at offset pos. */
+static void tar_scan(struct tar_scan *s, const unsigned char *buf, size_t len, off_t pos)
+{
+	size_t n;
+
+	while (s->tar != NULL && len) {
+		if (pos < s->header) {
+			/* member data; keep that of an extended header */
+			n = (off_t)len < s->header - pos ? len : (size_t)(s->header - pos);
+			if (s->data != NULL && s->have < s->want) {
+				if (s->want - s->have < n)
+					n = s->want - s->have;
+				memcpy(s->data + s->have, buf, n);
+				s->have += n;
+			}
 		} else {
-			first = middle + 1;
-			len = len - half - 1;
+			n = TAR_BLOCK - s->fill < len ? TAR_BLOCK - s->fill : len;
+			memcpy(s->block + s->fill, buf, n);
+			s->fill += n;
+			if (s->fill == TAR_BLOCK) {
+				s->fill = 0;
+				tar_header(s);
+			}
 		}
+		buf += n;
+		len -= n;
+		pos += n;
 	}
+}
 
-	/* decrement the point */
-	return (first == &index->list[0] ? NULL : first-1);
+static void tar_scan_init(struct tar_scan *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->size = -1;
+	s->tar = (struct tar*)calloc(1, sizeof(struct tar));
 }
-#endif/*SEEKGZIP_OPTIMIZATION*/
+
+/* The members found, or NULL if the stream is not a tar archive. */
+static struct tar *tar_scan_end(struct tar_scan *s, struct tar *tar)
+{
+	free(s->data);
+	free(s->name);
+	if (tar != NULL && tar->n == 0) {
+		tar_free(tar);
+		tar = NULL;
+	}
+	return tar;
+}
+
+/* A name as given, or without a leading "./". */
+static const char *tar_name(const char *name)
+{
+	return strncmp(name, "./", 2) == 0 && name[2] ? name + 2 : name;
+}
+
+intmax_t seekgzip_tar_count(seekgzip_t *sz)
+{
+	if (sz->index == NULL || sz->index->tar == NULL)
+		return 0;
+	return (intmax_t)sz->index->tar->n;
+}
+
+int seekgzip_tar_member(seekgzip_t *sz, intmax_t i, const char **name, off_t *offset, off_t *size, int *type)
+{
+	struct tar_member *m;
+
+	if (i < 0 || seekgzip_tar_count(sz) <= i)
+		return SEEKGZIP_ERROR;
+	m = &sz->index->tar->members[i];
+	if (name != NULL)
+		*name = m->name;
+	if (offset != NULL)
+		*offset = m->offset;
+	if (size != NULL)
+		*size = m->size;
+	if (type != NULL)
+		*type = m->type;
+	return SEEKGZIP_SUCCESS;
+}
+
+intmax_t seekgzip_tar_find(seekgzip_t *sz, const char *name)
+{
+	intmax_t i;
+
+	// A later member of the same name replaces an earlier one, as in tar.
+	for (i = seekgzip_tar_count(sz) - 1;0 <= i;--i) {
+		if (strcmp(tar_name(sz->index->tar->members[i].name), tar_name(name)) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/*===== End of tar members ===== }}}*/
 
 /* Make one entire pass through the compressed stream and build an index, with
    access points about every span bytes of uncompressed output -- span is
    chosen to balance the speed of random access against the memory requirements
-   of the list, about 32K bytes per access point.  Note that data after the end
-   of the first zlib or gzip stream in the file is ignored.  build_index()
-   returns the number of access points on success (>= 1), Z_MEM_ERROR for out
-   of memory, Z_DATA_ERROR for an error in the input file, or Z_ERRNO for a
-   file read error.  On success, *built points to the resulting index. */
-static int build_index(FILE *in, off_t span, struct access **built, seekgzip_t *sz)
+   of the list, about 32K bytes per access point.  Further gzip members after
+   the first one are indexed as part of the same stream; other data after the
+   end of the first zlib or gzip stream in the file is ignored.  build_index()
+   returns Z_OK on success, Z_MEM_ERROR for out of memory, Z_DATA_ERROR for an error in the input file, or Z_ERRNO for a
+   file read error.  On success, *built points to the resulting index.  The
+   CRC-32 of the uncompressed data between neighbouring access points is
+   recorded in the earlier point. */
+static int build_index(seekgzip_source_t *in, off_t span, struct access **built, seekgzip_t *sz)
 {
 	int ret;
+	ssize_t got;
 	off_t totin, totout;		/* our own total counters to avoid 4GB limit */
 	off_t last;				 /* totout value of last access point */
+	uLong crc;				 /* CRC-32 of the current span */
+	unsigned char *produced;
 	struct access *index = *built; /* access points being generated */
+	struct tar_scan scan;		/* members, if the data is a tar archive */
+	struct tar *tar;
 	z_stream strm;
 	unsigned char input[CHUNK];
 	unsigned char window[WINSIZE];
@@ -195,27 +804,27 @@ static int build_index(FILE *in, off_t span, struct access **built, seekgzip_t *
 	ret = inflateInit2(&strm, 47);	  /* automatic zlib or gzip decoding */
 	if (ret != Z_OK)
 		return ret;
-	
-	// Rewind to beginning  of file
-	if( (ret = fseeko(in, 0, SEEK_SET)) == -1)
-		goto build_index_error;
+	tar_scan_init(&scan);
+	tar = scan.tar;
 
 	/* inflate the input, maintain a sliding window, and build an index -- this
 	   also validates the integrity of the compressed data using the check
 	   information at the end of the gzip or zlib stream */
 	totin = totout = last = 0;
+	crc = crc32(0L, Z_NULL, 0);
 	strm.avail_out = 0;
 	do {
 		/* get some compressed data from input file */
-		strm.avail_in = fread(input, 1, CHUNK, in);
-		if (ferror(in)) {
+		got = in->read_at(in, input, CHUNK, totin);
+		if (got < 0) {
 			ret = Z_ERRNO;
 			goto build_index_error;
 		}
-		if (strm.avail_in == 0) {
+		if (got == 0) {
 			ret = Z_DATA_ERROR;
 			goto build_index_error;
 		}
+		strm.avail_in = (unsigned)got;
 		strm.next_in = input;
 
 		/* process all of that, or until end of stream */
@@ -230,6 +839,7 @@ static int build_index(FILE *in, off_t span, struct access **built, seekgzip_t *
 			   update the total input and output counters */
 			totin += strm.avail_in;
 			totout += strm.avail_out;
+			produced = strm.next_out;
 			ret = inflate(&strm, Z_BLOCK);	  /* return at end of block */
 			totin -= strm.avail_in;
 			totout -= strm.avail_out;
@@ -237,8 +847,15 @@ static int build_index(FILE *in, off_t span, struct access **built, seekgzip_t *
 				ret = Z_DATA_ERROR;
 			if (ret == Z_MEM_ERROR || ret == Z_DATA_ERROR)
 				goto build_index_error;
-			if (ret == Z_STREAM_END)
-				break;
+			crc = crc32_fast(crc, produced, strm.next_out - produced);
+			tar_scan(&scan, produced, strm.next_out - produced, totout - (strm.next_out - produced));
+			if (ret == Z_STREAM_END) {
+				if (!next_member(in, &strm, totin))
+					break;
+				index->members = 1;
+				ret = Z_OK;
+				continue;
+			}
 
 			/* if at end of block, consider adding an index entry (note that if
 			   data_type indicates an end-of-block, then all of the
@@ -251,6 +868,10 @@ static int build_index(FILE *in, off_t span, struct access **built, seekgzip_t *
 			 */
 			if ((strm.data_type & 128) && !(strm.data_type & 64) &&
 				(totout == 0 || totout - last > span)) {
+				if (index->nelements) {
+					index->list[index->nelements - 1].crc = (uint32_t)crc;
+					crc = crc32(0L, Z_NULL, 0);
+				}
 				index = addpoint(index, strm.data_type & 7, totin,
 								 totout, strm.avail_out, window);
 				if (index == NULL) {
@@ -264,15 +885,128 @@ static int build_index(FILE *in, off_t span, struct access **built, seekgzip_t *
 
 	/* clean up and return index (release unused entries in list) */
 	(void)inflateEnd(&strm);
-	index->list = (struct point*)realloc(index->list, sizeof(struct point) * index->nelements);
-	index->allocated = index->nelements;
+	index->list[index->nelements - 1].crc = (uint32_t)crc;
+	index->crc = 1;
+	index->tar = tar_scan_end(&scan, tar);
+	access_resize(index, index->nelements);
 	*built = index;
 	sz->totin  = totin;
 	sz->totout = totout;
-	return index->allocated;
+	return Z_OK;
 
 	/* return error */
   build_index_error:
+	(void)inflateEnd(&strm);
+	tar_free(tar_scan_end(&scan, tar));
+	return ret;
+}
+
+/* Decode the span from access point here up to the uncompressed offset end
+   and append access points to *built about every span bytes, as
+   build_index() does for the whole stream: here itself first, then points
+   at the deflate block boundaries inside the span, each with the CRC-32 of
+   the data up to the next one.  Returns Z_OK or a negative zlib error. */
+static int index_span(seekgzip_source_t *in, struct point *here, off_t end,
+	off_t span, struct access **built)
+{
+	int ret, raw = here->bits != MEMBER_START;
+	ssize_t got;
+	unsigned cut;
+	off_t totin, totout, last;
+	uLong crc;
+	unsigned char *produced;
+	struct access *index = *built;
+	z_stream strm;
+	unsigned char input[CHUNK];
+	unsigned char window[WINSIZE];
+
+	/* initialize inflate at the access point */
+	ret = start_point(in, &strm, here, &totin, input);
+	if (ret != Z_OK)
+		return ret;
+
+	/* the sliding window starts out as the window of the point */
+	if (here->window != NULL)
+		memcpy(window, here->window, WINSIZE);
+	else
+		memset(window, 0, WINSIZE);
+	index = addpoint(index, here->bits, here->in, here->out, 0, window);
+	if (index == NULL) {
+		ret = Z_MEM_ERROR;
+		goto index_span_error;
+	}
+	totout = last = here->out;
+	crc = crc32(0L, Z_NULL, 0);
+	strm.avail_out = 0;
+	while (totout < end) {
+		if (strm.avail_in == 0) {
+			got = in->read_at(in, input, CHUNK, totin);
+			if (got <= 0) {
+				ret = got < 0 ? Z_ERRNO : Z_DATA_ERROR;
+				goto index_span_error;
+			}
+			strm.avail_in = (unsigned)got;
+			strm.next_in = input;
+		}
+		if (strm.avail_out == 0) {
+			strm.avail_out = WINSIZE;
+			strm.next_out = window;
+		}
+
+		/* do not decode past end, but keep the window position */
+		cut = 0;
+		if (end - totout < (off_t)strm.avail_out) {
+			cut = strm.avail_out - (unsigned)(end - totout);
+			strm.avail_out -= cut;
+		}
+		totin += strm.avail_in;
+		totout += strm.avail_out;
+		produced = strm.next_out;
+		ret = inflate(&strm, Z_BLOCK);	  /* return at end of block */
+		totin -= strm.avail_in;
+		totout -= strm.avail_out;
+		strm.avail_out += cut;
+		if (ret == Z_NEED_DICT)
+			ret = Z_DATA_ERROR;
+		if (ret == Z_MEM_ERROR || ret == Z_DATA_ERROR)
+			goto index_span_error;
+		crc = crc32_fast(crc, produced, strm.next_out - produced);
+		if (ret == Z_STREAM_END) {
+			/* raw inflate leaves the 8-byte gzip trailer unread */
+			if (raw)
+				totin += 8;
+			if (!next_member(in, &strm, totin))
+				break;
+			raw = 0;
+			strm.avail_in = 0;
+			ret = Z_OK;
+			continue;
+		}
+
+		if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+			totout < end && totout - last > span) {
+			index->list[index->nelements - 1].crc = (uint32_t)crc;
+			crc = crc32(0L, Z_NULL, 0);
+			index = addpoint(index, strm.data_type & 7, totin,
+							 totout, strm.avail_out, window);
+			if (index == NULL) {
+				ret = Z_MEM_ERROR;
+				goto index_span_error;
+			}
+			last = totout;
+		}
+	}
+	if (totout != end) {
+		ret = Z_DATA_ERROR;
+		goto index_span_error;
+	}
+
+	(void)inflateEnd(&strm);
+	index->list[index->nelements - 1].crc = (uint32_t)crc;
+	*built = index;
+	return Z_OK;
+
+  index_span_error:
 	(void)inflateEnd(&strm);
 	return ret;
 }
@@ -283,11 +1017,15 @@ static int build_index(FILE *in, off_t span, struct access **built, seekgzip_t *
    than len, indicating how much as actually read into buf.  This function
    should not return a data error unless the file was modified since the index
    was generated.  extract() may also return Z_ERRNO if there is an error on
-   reading or seeking the input file. */
-static int extract(FILE *in, struct access *index, off_t offset,
+   reading or seeking the input file.  The input is read with positioned
+   reads and no state is shared between calls, so extract() may run
+   concurrently on the same source. */
+static int extract(seekgzip_source_t *in, struct access *index, off_t offset,
 				  unsigned char *buf, int len)
 {
-	int ret, skip;
+	int ret, skip, raw;
+	ssize_t got;
+	off_t pos;
 	z_stream strm;
 	struct point *here;
 	unsigned char input[CHUNK];
@@ -312,26 +1050,10 @@ static int extract(FILE *in, struct access *index, off_t offset,
 #endif/*SEEKGZIP_OPTIMIZATION*/
 
 	/* initialize file and inflate state to start there */
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	strm.avail_in = 0;
-	strm.next_in = Z_NULL;
-	ret = inflateInit2(&strm, -15);		 /* raw inflate */
+	ret = start_point(in, &strm, here, &pos, input);
 	if (ret != Z_OK)
 		return ret;
-	ret = fseeko(in, here->in - (here->bits ? 1 : 0), SEEK_SET);
-	if (ret == -1)
-		goto extract_ret;
-	if (here->bits) {
-		ret = getc(in);
-		if (ret == -1) {
-			ret = ferror(in) ? Z_ERRNO : Z_DATA_ERROR;
-			goto extract_ret;
-		}
-		(void)inflatePrime(&strm, here->bits, ret >> (8 - here->bits));
-	}
-	(void)inflateSetDictionary(&strm, here->window, WINSIZE);
+	raw = here->bits != MEMBER_START;
 
 	/* skip uncompressed bytes until offset reached, then satisfy request */
 	offset -= here->out;
@@ -358,15 +1080,17 @@ static int extract(FILE *in, struct access *index, off_t offset,
 		/* uncompress until avail_out filled, or end of stream */
 		do {
 			if (strm.avail_in == 0) {
-				strm.avail_in = fread(input, 1, CHUNK, in);
-				if (ferror(in)) {
+				got = in->read_at(in, input, CHUNK, pos);
+				if (got < 0) {
 					ret = Z_ERRNO;
 					goto extract_ret;
 				}
-				if (strm.avail_in == 0) {
+				if (got == 0) {
 					ret = Z_DATA_ERROR;
 					goto extract_ret;
 				}
+				pos += got;
+				strm.avail_in = (unsigned)got;
 				strm.next_in = input;
 			}
 			ret = inflate(&strm, Z_NO_FLUSH);	   /* normal inflate */
@@ -374,8 +1098,17 @@ static int extract(FILE *in, struct access *index, off_t offset,
 				ret = Z_DATA_ERROR;
 			if (ret == Z_MEM_ERROR || ret == Z_DATA_ERROR)
 				goto extract_ret;
-			if (ret == Z_STREAM_END)
-				break;
+			if (ret == Z_STREAM_END) {
+				/* continue with the next gzip member, if any */
+				pos -= strm.avail_in;
+				if (raw)
+					pos += 8;		   /* skip the trailer */
+				if (!next_member(in, &strm, pos))
+					break;
+				raw = 0;
+				strm.avail_in = 0;
+				ret = Z_OK;
+			}
 		} while (strm.avail_out != 0);
 
 		/* if reach end of stream, then don't keep trying to get more */
@@ -396,77 +1129,2234 @@ static int extract(FILE *in, struct access *index, off_t offset,
 
 /*===== End of the portion of zran.c ===== }}}*/
 
-static char *get_index_file(const char *target)
+/* Streaming counterpart of extract(): an inflate state that is positioned at
+   an uncompressed offset once and then keeps decoding forward, so that
+   sequential consumers do not restart from an access point on every call. */
+struct cursor {
+	seekgzip_source_t     *src;
+	off_t                  pos;		/* next offset to read from src */
+	z_stream               strm;
+	off_t                  out;		/* uncompressed offset of the next byte */
+	int                    eof;
+	int                    raw;		/* inside a raw deflate stream */
+	unsigned char          input[CHUNK];
+};
+
+/* Read up to len bytes at the cursor; returns the number of bytes produced
+   (less than len only at the end of the stream) or a negative zlib error. */
+static int cursor_read(struct cursor *c, unsigned char *buf, int len)
 {
-	char *idx = (char*)malloc(strlen(target) + 4 + 1);
-	if (idx == NULL) {
-		return NULL;
+	int ret;
+	ssize_t got;
+
+	if (c->eof || len <= 0)
+		return 0;
+
+	c->strm.next_out = buf;
+	c->strm.avail_out = len;
+	while (c->strm.avail_out != 0) {
+		if (c->strm.avail_in == 0) {
+			got = c->src->read_at(c->src, c->input, CHUNK, c->pos);
+			if (got < 0)
+				return Z_ERRNO;
+			if (got == 0)
+				return Z_DATA_ERROR;
+			c->pos += got;
+			c->strm.avail_in = (unsigned)got;
+			c->strm.next_in = c->input;
+		}
+		ret = inflate(&c->strm, Z_NO_FLUSH);
+		if (ret == Z_NEED_DICT)
+			ret = Z_DATA_ERROR;
+		if (ret == Z_MEM_ERROR || ret == Z_DATA_ERROR)
+			return ret;
+		if (ret == Z_STREAM_END) {
+			c->pos -= c->strm.avail_in;
+			if (c->raw)
+				c->pos += 8;
+			if (!next_member(c->src, &c->strm, c->pos)) {
+				c->eof = 1;
+				break;
+			}
+			c->raw = 0;
+			c->strm.avail_in = 0;
+		}
 	}
-	strcpy(idx, target);
-	strcat(idx, ".idx");
-	return idx;	
+
+	len -= c->strm.avail_out;
+	c->out += len;
+	return len;
 }
 
-static int write_uint32(gzFile gz, uint32_t v)
+static void cursor_close(struct cursor *c)
 {
-	return gzwrite(gz, &v, sizeof(v));
+	(void)inflateEnd(&c->strm);
 }
 
-static uint32_t read_uint32(gzFile gz)
+/* Position a cursor at offset, starting from the nearest access point. */
+static int cursor_open(struct cursor *c, seekgzip_source_t *in, struct access *index, off_t offset)
 {
-	uint32_t v;
-	gzread(gz, &v, sizeof(v));
-	return v;
-}
+	int ret;
+	struct point *here;
+	unsigned char discard[WINSIZE];
 
-void seekgzip_index_free(seekgzip_t *sz){
-	if(sz->index == NULL)
-		return;
-	
-	if(sz->index->list != NULL)
-		free(sz->index->list);
-	
-	free(sz->index);
-	sz->index = NULL;
-}
+	here = findpoint(index, offset);
+	if (here == NULL)
+		return Z_DATA_ERROR;
 
-int seekgzip_index_alloc(seekgzip_t *sz){
-	if(sz->index != NULL)
-		seekgzip_index_free(sz);
+	c->src = in;
+	c->out = here->out;
+	c->eof = 0;
+	c->raw = here->bits != MEMBER_START;
+	ret = start_point(in, &c->strm, here, &c->pos, c->input);
+	if (ret != Z_OK)
+		return ret;
+
+	/* skip uncompressed bytes until offset reached */
+	while (c->out < offset && !c->eof) {
+		off_t skip = offset - c->out;
+		ret = cursor_read(c, discard, WINSIZE < skip ? (int)WINSIZE : (int)skip);
+		if (ret < 0)
+			goto cursor_open_error;
+	}
+	return Z_OK;
+
+  cursor_open_error:
+	cursor_close(c);
+	return ret;
+}
+
+/* The end of the span that starts at access point id. */
+static off_t span_end(seekgzip_t *sz, uintmax_t id)
+{
+	return id + 1 < sz->index->nelements ? sz->index->list[id + 1].out : sz->totout;
+}
+
+/* Extracting a tar member decodes it once with a cursor from the access point
+   before it, instead of a read (and a restart from an access point) per
+   buffer; with SEEKGZIP_VERIFY the CRC of every span decoded completely on
+   the way is checked. */
+int seekgzip_tar_read(seekgzip_t *sz, intmax_t i, seekgzip_tar_callback callback, void *instance)
+{
+	int ret, verify = (sz->flags & SEEKGZIP_VERIFY) != 0;
+	uintmax_t id;
+	off_t offset, end, start, limit, next;
+	uLong crc = crc32(0L, Z_NULL, 0);
+	unsigned char buffer[CHUNK];
+	struct cursor c;
+	struct point *here;
+
+	if (seekgzip_tar_member(sz, i, NULL, &offset, &end, NULL) != SEEKGZIP_SUCCESS)
+		return SEEKGZIP_ERROR;
+	end += offset;
+	if( (here = findpoint(sz->index, offset)) == NULL)
+		return SEEKGZIP_DATAERROR;
+	id = here - sz->index->list;
+	if( (ret = cursor_open(&c, sz->src, sz->index, verify ? here->out : offset)) != Z_OK)
+		return ret == Z_MEM_ERROR ? SEEKGZIP_OUTOFMEMORY : ret == Z_ERRNO ? SEEKGZIP_READERROR : SEEKGZIP_DATAERROR;
+
+	while (c.out < end) {
+		// Stop at the member start and, when verifying, at span ends.
+		next = verify ? span_end(sz, id) : end;
+		limit = c.out < offset ? offset : end;
+		if (next < limit)
+			limit = next;
+		if (CHUNK < limit - c.out)
+			limit = c.out + CHUNK;
+
+		start = c.out;
+		ret = cursor_read(&c, buffer, (int)(limit - c.out));
+		if (ret <= 0) {
+			ret = ret < 0 ? ret : Z_DATA_ERROR;
+			break;
+		}
+		if (verify) {
+			crc = crc32_fast(crc, buffer, ret);
+			if (c.out == next) {
+				if ((uint32_t)crc != sz->index->list[id].crc) {
+					ret = Z_DATA_ERROR;
+					break;
+				}
+				crc = crc32(0L, Z_NULL, 0);
+				id++;
+			}
+		}
+		if (offset <= start)
+			callback(instance, buffer, (size_t)ret);
+	}
+	cursor_close(&c);
+
+	if (ret < 0)
+		return ret == Z_MEM_ERROR ? SEEKGZIP_OUTOFMEMORY : ret == Z_ERRNO ? SEEKGZIP_READERROR : SEEKGZIP_DATAERROR;
+	return SEEKGZIP_SUCCESS;
+}
+
+/*===== Verification ===== {{{*/
+
+static struct access *hot_span(seekgzip_t *sz, uintmax_t id);
+
+/* A variant of extract() for SEEKGZIP_VERIFY: decoding starts at the access
+   point as usual, and the CRC of every span that gets decoded completely on
+   the way to offset + size is checked against the index.  A read that stays
+   inside a span with checkpoints starts at the nearest checkpoint instead
+   and checks the pieces between checkpoints. */
+static int verify_read(seekgzip_t *sz, unsigned char *buf, int size, off_t offset)
+{
+	int ret = Z_OK;
+	uintmax_t id;
+	off_t end = offset + size, limit, next, last = sz->totout;
+	uLong crc = crc32(0L, Z_NULL, 0);
+	unsigned char *dst;
+	unsigned char discard[WINSIZE];
+	struct cursor c;
+	struct access *index = sz->index, *sub;
+	struct point *here = findpoint(sz->index, offset);
+
+	if (here == NULL || size <= 0)
+		return 0;
+	id = here - sz->index->list;
+	if (sz->hot != NULL && (sub = hot_span(sz, id)) != NULL && end <= span_end(sz, id)) {
+		last = span_end(sz, id);
+		index = sub;
+		here = findpoint(sub, offset);
+		id = here - sub->list;
+	}
+	if( (ret = cursor_open(&c, sz->src, index, here->out)) != Z_OK)
+		return ret;
+
+	while (c.out < end) {
+		next = id + 1 < index->nelements ? index->list[id + 1].out : last;
+		limit = (c.out < offset && offset < next) ? offset : next;
+		if (end < limit)
+			limit = end;
+		if (c.out < offset) {
+			dst = discard;
+			if (WINSIZE < limit - c.out)
+				limit = c.out + WINSIZE;
+		} else {
+			dst = buf + (c.out - offset);
+		}
+
+		ret = cursor_read(&c, dst, (int)(limit - c.out));
+		if (ret <= 0)
+			break;
+		crc = crc32_fast(crc, dst, ret);
+		if (c.out == next) {
+			if ((uint32_t)crc != index->list[id].crc) {
+				ret = Z_DATA_ERROR;
+				break;
+			}
+			crc = crc32(0L, Z_NULL, 0);
+			id++;
+		}
+	}
+	cursor_close(&c);
+
+	if (ret < 0)
+		return ret;
+	return offset < c.out ? (int)(c.out - offset) : 0;
+}
+
+/* Decode spans on worker threads, check their CRCs, and check the CRC of the
+   whole stream, combined from the spans, against the gzip trailer.  An index
+   without span CRCs (an imported one) gets the computed CRCs once the whole
+   stream checked out: against the trailer of a single gzip member, or by
+   inflate when every span starts at a member header. */
+struct verify {
+	seekgzip_t            *sz;
+	pthread_mutex_t        mutex;
+	uintmax_t              next;		/* next span to decode */
+	uLong                 *crcs;		/* computed CRC of each span */
+	seekgzip_verify_callback callback;
+	void                  *instance;
+	int                    ret;
+};
+
+static void *verify_worker(void *arg)
+{
+	struct verify *v = (struct verify*)arg;
+	seekgzip_t *sz = v->sz;
+	uintmax_t id;
+	off_t end;
+	uLong crc;
+	int ret;
+	struct cursor c;
+	unsigned char *buffer = (unsigned char*)malloc(SPAN);
+
+	for (;;) {
+		pthread_mutex_lock(&v->mutex);
+		id = v->next++;
+		pthread_mutex_unlock(&v->mutex);
+		if (sz->index->nelements <= id)
+			break;
+
+		end = span_end(sz, id);
+		crc = crc32(0L, Z_NULL, 0);
+		ret = buffer == NULL ? Z_MEM_ERROR : cursor_open(&c, sz->src, sz->index, sz->index->list[id].out);
+		if (ret == Z_OK) {
+			while (c.out < end) {
+				ret = cursor_read(&c, buffer, (int)(SPAN < end - c.out ? SPAN : end - c.out));
+				if (ret <= 0) {
+					ret = ret < 0 ? ret : Z_DATA_ERROR;
+					break;
+				}
+				crc = crc32_fast(crc, buffer, ret);
+			}
+			cursor_close(&c);
+		}
+		if (0 <= ret)
+			ret = (!sz->index->crc || (uint32_t)crc == sz->index->list[id].crc) ?
+				SEEKGZIP_SUCCESS : SEEKGZIP_DATAERROR;
+		else
+			ret = ret == Z_MEM_ERROR ? SEEKGZIP_OUTOFMEMORY : ret == Z_ERRNO ? SEEKGZIP_READERROR : SEEKGZIP_DATAERROR;
+
+		pthread_mutex_lock(&v->mutex);
+		v->crcs[id] = crc;
+		if (ret != SEEKGZIP_SUCCESS) {
+			if (v->ret == SEEKGZIP_SUCCESS)
+				v->ret = ret;
+			if (v->callback != NULL)
+				v->callback(v->instance, sz->index->list[id].out, end, ret);
+		}
+		pthread_mutex_unlock(&v->mutex);
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+int seekgzip_verify(seekgzip_t *sz, int nthreads, seekgzip_verify_callback callback, void *instance)
+{
+	int i, started, checked = 0;
+	uintmax_t id;
+	uLong crc;
+	uint32_t expected, isize;
+	unsigned char trailer[8];
+	pthread_t *threads;
+	struct verify v;
+
+	if (sz->index == NULL)
+		return SEEKGZIP_ERROR;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	memset(&v, 0, sizeof(v));
+	v.sz = sz;
+	v.callback = callback;
+	v.instance = instance;
+	v.ret = SEEKGZIP_SUCCESS;
+	v.crcs = (uLong*)calloc(sz->index->nelements, sizeof(uLong));
+	threads = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+	if (v.crcs == NULL || threads == NULL) {
+		free(v.crcs);
+		free(threads);
+		return SEEKGZIP_OUTOFMEMORY;
+	}
+	pthread_mutex_init(&v.mutex, NULL);
+
+	for (started = 0;started < nthreads;++started) {
+		if (pthread_create(&threads[started], NULL, verify_worker, &v) != 0)
+			break;
+	}
+	if (started == 0)
+		verify_worker(&v);
+	for (i = 0;i < started;++i)
+		pthread_join(threads[i], NULL);
+
+	/* the trailer of a gzip stream holds the CRC-32 and size mod 2^32 */
+	if (v.ret == SEEKGZIP_SUCCESS) {
+		crc = crc32(0L, Z_NULL, 0);
+		for (id = 0;id < sz->index->nelements;++id) {
+			crc = crc32_combine(crc, v.crcs[id],
+				(z_off_t)(span_end(sz, id) - sz->index->list[id].out));
+		}
+		if (sz->src->read_at(sz->src, trailer, 2, 0) != 2) {
+			v.ret = SEEKGZIP_READERROR;
+		} else if (trailer[0] != 0x1f || trailer[1] != 0x8b) {
+			/* a zlib stream ends with an Adler-32 instead */
+		} else if (sz->index->members) {
+			/* the trailers of members decoded from their headers were
+			   checked by inflate */
+			for (id = 0;id < sz->index->nelements && sz->index->list[id].bits == MEMBER_START;++id)
+				;
+			checked = id == sz->index->nelements;
+		} else if (sz->src->read_at(sz->src, trailer, 8, sz->totin - 8) != 8) {
+			v.ret = SEEKGZIP_READERROR;
+		} else {
+			expected = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+			isize = trailer[4] | trailer[5] << 8 | trailer[6] << 16 | (uint32_t)trailer[7] << 24;
+			if ((uint32_t)crc != expected || isize != (uint32_t)sz->totout) {
+				v.ret = SEEKGZIP_DATAERROR;
+				if (callback != NULL)
+					callback(instance, 0, sz->totout, v.ret);
+			} else {
+				checked = 1;
+			}
+		}
+	}
+
+	if (v.ret == SEEKGZIP_SUCCESS && checked && !sz->index->crc) {
+		for (id = 0;id < sz->index->nelements;++id)
+			sz->index->list[id].crc = (uint32_t)v.crcs[id];
+		sz->index->crc = 1;
+		seekgzip_index_save(sz);
+	}
+
+	pthread_mutex_destroy(&v.mutex);
+	free(threads);
+	free(v.crcs);
+	return v.ret;
+}
+
+/*===== End of verification ===== }}}*/
+
+/*===== Span cache ===== {{{*/
+
+/* Decoded spans (the uncompressed data between two neighbouring access
+   points) kept in memory with least-recently-used eviction.  Lookups are
+   serialised by a mutex, decoding is not: entries are reference counted so
+   that a span being copied out is never released underneath the reader. */
+
+#define CACHE_BUCKETS 1024
+
+struct span {
+	uintmax_t              id;		/* index of the access point */
+	off_t                  out;		/* uncompressed offset of data[0] */
+	size_t                 size;
+	int                    refs;
+	struct span           *hnext;		/* hash chain */
+	struct span           *prev, *next;	/* LRU list, most recent first */
+	unsigned char         *data;
+};
+
+struct cache {
+	pthread_mutex_t        mutex;
+	size_t                 limit;
+	size_t                 size;
+	struct span           *head, *tail;
+	struct span           *buckets[CACHE_BUCKETS];
+};
+
+static void cache_unlink(struct cache *c, struct span *e)
+{
+	struct span **p = &c->buckets[e->id % CACHE_BUCKETS];
+
+	while (*p != e)
+		p = &(*p)->hnext;
+	*p = e->hnext;
+	if (e->prev) e->prev->next = e->next; else c->head = e->next;
+	if (e->next) e->next->prev = e->prev; else c->tail = e->prev;
+	c->size -= e->size;
+}
+
+static void cache_touch(struct cache *c, struct span *e)
+{
+	if (c->head == e)
+		return;
+	e->prev->next = e->next;
+	if (e->next) e->next->prev = e->prev; else c->tail = e->prev;
+	e->prev = NULL;
+	e->next = c->head;
+	c->head->prev = e;
+	c->head = e;
+}
+
+/* Evict unreferenced spans from the tail until the cache fits its limit. */
+static void cache_shrink(struct cache *c)
+{
+	struct span *e = c->tail, *prev;
+
+	while (e != NULL && c->limit < c->size) {
+		prev = e->prev;
+		if (e->refs == 0) {
+			cache_unlink(c, e);
+			free(e->data);
+			free(e);
+		}
+		e = prev;
+	}
+}
+
+static void cache_release(struct cache *c, struct span *e)
+{
+	pthread_mutex_lock(&c->mutex);
+	e->refs--;
+	cache_shrink(c);
+	pthread_mutex_unlock(&c->mutex);
+}
+
+/* Return the (referenced) span holding offset, decoding it on a miss. */
+static struct span *cache_get(seekgzip_t *sz, off_t offset, int *error)
+{
+	struct cache *c = sz->cache;
+	struct access *index = sz->index;
+	struct point *here = findpoint(index, offset);
+	struct span *e, *hit;
+	uintmax_t id;
+	off_t end;
+	int ret;
+
+	*error = 0;
+	if (here == NULL || sz->totout <= offset)
+		return NULL;
+	id = here - index->list;
+
+	pthread_mutex_lock(&c->mutex);
+	for (e = c->buckets[id % CACHE_BUCKETS]; e != NULL; e = e->hnext) {
+		if (e->id == id) {
+			e->refs++;
+			cache_touch(c, e);
+			pthread_mutex_unlock(&c->mutex);
+			return e;
+		}
+	}
+	pthread_mutex_unlock(&c->mutex);
+
+	/* decode the whole span without holding the lock */
+	end = id + 1 < index->nelements ? here[1].out : sz->totout;
+	if( (e = (struct span*)calloc(1, sizeof(struct span))) == NULL ||
+		(e->data = (unsigned char*)malloc((size_t)(end - here->out))) == NULL){
+		free(e);
+		*error = Z_MEM_ERROR;
+		return NULL;
+	}
+	e->id = id;
+	e->out = here->out;
+	e->size = (size_t)(end - here->out);
+	ret = extract(sz->src, index, here->out, e->data, (int)e->size);
+	if (ret == (int)e->size && (sz->flags & SEEKGZIP_VERIFY) &&
+		crc32_fast(crc32(0L, Z_NULL, 0), e->data, e->size) != here->crc)
+		ret = Z_DATA_ERROR;
+	if (ret != (int)e->size) {
+		free(e->data);
+		free(e);
+		*error = ret < 0 ? ret : Z_DATA_ERROR;
+		return NULL;
+	}
+
+	/* another thread may have inserted the same span meanwhile */
+	pthread_mutex_lock(&c->mutex);
+	for (hit = c->buckets[id % CACHE_BUCKETS]; hit != NULL; hit = hit->hnext) {
+		if (hit->id == id)
+			break;
+	}
+	if (hit != NULL) {
+		free(e->data);
+		free(e);
+		e = hit;
+		cache_touch(c, e);
+	} else {
+		e->hnext = c->buckets[id % CACHE_BUCKETS];
+		c->buckets[id % CACHE_BUCKETS] = e;
+		e->next = c->head;
+		if (c->head) c->head->prev = e; else c->tail = e;
+		c->head = e;
+		c->size += e->size;
+	}
+	e->refs++;
+	cache_shrink(c);
+	pthread_mutex_unlock(&c->mutex);
+	return e;
+}
+
+static int cache_read(seekgzip_t *sz, unsigned char *buf, int size, off_t offset)
+{
+	int n = 0, error;
+	size_t len;
+	struct span *e;
+
+	while (n < size) {
+		e = cache_get(sz, offset, &error);
+		if (e == NULL)
+			return (n == 0 && error < 0) ? error : n;
+		len = e->size - (size_t)(offset - e->out);
+		if ((size_t)(size - n) < len)
+			len = size - n;
+		memcpy(buf + n, e->data + (offset - e->out), len);
+		cache_release(sz->cache, e);
+		n += len;
+		offset += len;
+	}
+	return n;
+}
+
+static void cache_free(seekgzip_t *sz)
+{
+	struct cache *c = sz->cache;
+	struct span *e, *next;
+
+	if (c == NULL)
+		return;
+	for (e = c->head; e != NULL; e = next) {
+		next = e->next;
+		free(e->data);
+		free(e);
+	}
+	pthread_mutex_destroy(&c->mutex);
+	free(c);
+	sz->cache = NULL;
+}
+
+int seekgzip_cache(seekgzip_t *sz, size_t limit)
+{
+	struct cache *c;
+
+	cache_free(sz);
+	if (limit == 0)
+		return SEEKGZIP_SUCCESS;
+	if (sz->index == NULL)
+		return SEEKGZIP_ERROR;
+
+	if( (c = (struct cache*)calloc(1, sizeof(struct cache))) == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+	c->limit = limit;
+	pthread_mutex_init(&c->mutex, NULL);
+	sz->cache = c;
+	return SEEKGZIP_SUCCESS;
+}
+
+/*===== End of span cache ===== }}}*/
+
+/*===== Checkpoints ===== {{{*/
+
+/* Adaptive checkpoints: every read counts a hit on the span it starts in,
+   and once a span has been hit HOT_HITS times it is decoded once more to
+   collect access points about every step bytes inside it (index_span()).
+   Later reads in the span start from the nearest of those instead of the
+   beginning of the span.  The checkpoints of a span are published with a
+   single pointer store and never change afterwards, so readers need no
+   lock; they stop being added when their memory would exceed the limit. */
+
+#define HOT_HITS 8			/* reads in a span before it gets checkpoints */
+#define CHECKPOINT_STEP 32768		/* default distance between checkpoints */
+#define CHECKPOINT_LIMIT (64 << 20)	/* default memory for checkpoints */
+
+struct hot {
+	off_t                  step;
+	size_t                 limit;
+	size_t                 size;		/* memory used by checkpoints */
+	uintmax_t              n;		/* number of spans */
+	uint32_t              *hits;		/* reads started in each span */
+	struct access        **spans;		/* checkpoints of each span, or NULL */
+	int                    dirty;
+};
+
+/* The CRC of a span combined from the CRCs of its checkpoints. */
+static uint32_t hot_crc(struct access *sub, off_t end)
+{
+	uintmax_t i;
+	off_t next;
+	uLong crc = crc32(0L, Z_NULL, 0);
+
+	for (i = 0;i < sub->nelements;++i) {
+		next = i + 1 < sub->nelements ? sub->list[i + 1].out : end;
+		crc = crc32_combine(crc, sub->list[i].crc, (z_off_t)(next - sub->list[i].out));
+	}
+	return (uint32_t)crc;
+}
+
+/* Collect the checkpoints of span id, within the memory limit.  They are
+   dropped if the data decoded for them does not match the span CRC. */
+static struct access *hot_add(seekgzip_t *sz, uintmax_t id)
+{
+	struct hot *h = sz->hot;
+	struct point *here = &sz->index->list[id];
+	struct access *sub;
+	off_t end = span_end(sz, id);
+	size_t n = (size_t)((end - here->out) / h->step) + 1;	/* at most this many points */
+	size_t cost = n * (sizeof(struct point) + sizeof(off_t) + WINSIZE);
+
+	if (h->limit < __atomic_add_fetch(&h->size, cost, __ATOMIC_RELAXED))
+		goto error_exit;
+	if( (sub = (struct access*)calloc(1, sizeof(struct access))) == NULL)
+		goto error_exit;
+	if (window_reserve(sub, n) != 0 || index_span(sz->src, here, end, h->step, &sub) != Z_OK) {
+		access_free(sub);
+		goto error_exit;
+	}
+	access_resize(sub, sub->nelements);
+	if (sz->index->crc && hot_crc(sub, end) != here->crc) {
+		access_free(sub);
+		goto error_exit;
+	}
+	sub->crc = 1;
+	__atomic_sub_fetch(&h->size, (n - sub->nelements) * (sizeof(struct point) + sizeof(off_t)), __ATOMIC_RELAXED);
+	__atomic_store_n(&h->spans[id], sub, __ATOMIC_RELEASE);
+	__atomic_store_n(&h->dirty, 1, __ATOMIC_RELAXED);
+	return sub;
+
+error_exit:
+	__atomic_sub_fetch(&h->size, cost, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/* Count a read starting in span id; returns its checkpoints, or NULL. */
+static struct access *hot_span(seekgzip_t *sz, uintmax_t id)
+{
+	struct hot *h = sz->hot;
+	struct access *sub = __atomic_load_n(&h->spans[id], __ATOMIC_ACQUIRE);
+
+	if (sub == NULL && __atomic_load_n(&h->hits[id], __ATOMIC_RELAXED) < HOT_HITS &&
+		__atomic_add_fetch(&h->hits[id], 1, __ATOMIC_RELAXED) == HOT_HITS)
+		sub = hot_add(sz, id);
+	return sub;
+}
+
+static int hot_read(seekgzip_t *sz, unsigned char *buf, int size, off_t offset)
+{
+	struct point *here = findpoint(sz->index, offset);
+	struct access *sub;
+
+	if (here == NULL || size <= 0)
+		return 0;
+	sub = hot_span(sz, here - sz->index->list);
+	return extract(sz->src, sub != NULL ? sub : sz->index, offset, buf, size);
+}
+
+/* Replace the access points of every span that has checkpoints with them,
+   so that they can be saved with the index. */
+static int hot_merge(seekgzip_t *sz)
+{
+	struct hot *h = sz->hot;
+	struct access *index = sz->index;
+	struct point *list, *p;
+	uintmax_t i, n = 0;
+	int ret;
+
+	for (i = 0;i < index->nelements;++i)
+		n += h->spans[i] != NULL ? h->spans[i]->nelements : 1;
+	if( (list = p = (struct point*)malloc(sizeof(struct point) * n)) == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+	for (i = 0;i < index->nelements;++i) {
+		if (h->spans[i] != NULL) {
+			memcpy(p, h->spans[i]->list, sizeof(struct point) * h->spans[i]->nelements);
+			p += h->spans[i]->nelements;
+		} else {
+			*p++ = index->list[i];
+		}
+	}
+	ret = access_replace(index, list, n);
+	free(list);
+	return ret == 0 ? SEEKGZIP_SUCCESS : SEEKGZIP_OUTOFMEMORY;
+}
+
+static void hot_free(seekgzip_t *sz)
+{
+	uintmax_t i;
+	struct hot *h = sz->hot;
+
+	if (h == NULL)
+		return;
+	for (i = 0;i < h->n;++i)
+		access_free(h->spans[i]);
+	free(h->spans);
+	free(h->hits);
+	free(h);
+	sz->hot = NULL;
+}
+
+int seekgzip_checkpoints(seekgzip_t *sz, off_t step, size_t limit)
+{
+	struct hot *h;
+
+	hot_free(sz);
+	if (limit == 0)
+		return SEEKGZIP_SUCCESS;
+	if (sz->index == NULL)
+		return SEEKGZIP_ERROR;
+
+	if( (h = (struct hot*)calloc(1, sizeof(struct hot))) == NULL ||
+		(h->hits = (uint32_t*)calloc(sz->index->nelements, sizeof(uint32_t))) == NULL ||
+		(h->spans = (struct access**)calloc(sz->index->nelements, sizeof(struct access*))) == NULL){
+		if (h != NULL)
+			free(h->hits);
+		free(h);
+		return SEEKGZIP_OUTOFMEMORY;
+	}
+	h->step = 0 < step ? step : CHECKPOINT_STEP;
+	h->limit = limit;
+	h->n = sz->index->nelements;
+	sz->hot = h;
+	return SEEKGZIP_SUCCESS;
+}
+
+/*===== End of checkpoints ===== }}}*/
+
+/*===== Readahead ===== {{{*/
+
+
+/* With readahead enabled, a worker thread keeps a cursor just past the end of
+   the last read and decodes ahead into a ring buffer while the caller is busy
+   processing.  The worker is started once two consecutive seekgzip_read()
+   calls are seen and is cancelled by a read anywhere else.  The ring holds
+   the contiguous uncompressed range [begin, begin + used).  Under
+   SEEKGZIP_VERIFY the worker decodes every span from its start and checks
+   its CRC; the piece that completes a bad span is not published, and the
+   reader gets Z_DATA_ERROR instead. */
+
+#define READAHEAD_DEPTH 4		/* default number of spans decoded ahead */
+#define READAHEAD_STEP (4 * CHUNK)	/* bytes decoded between hand-overs */
+
+struct readahead {
+	pthread_t              thread;
+	pthread_mutex_t        mutex;
+	pthread_cond_t         cond;
+	seekgzip_source_t     *src;
+	struct access         *index;
+	off_t                  totout;
+	int                    verify;		/* check span CRCs */
+	unsigned char         *ring;
+	size_t                 capacity;
+	size_t                 head;		/* ring position of offset begin */
+	size_t                 used;		/* bytes buffered after begin */
+	off_t                  begin;
+	unsigned               generation;	/* bumped whenever readahead restarts */
+	int                    active;
+	int                    eof;
+	int                    error;
+	int                    stop;
+	off_t                  last;		/* end offset of the previous read */
+	int                    streak;		/* number of consecutive reads */
+};
+
+/* Open a cursor at target.  A verifying worker starts at the access point
+   instead and folds the bytes it skips into the CRC of span *id. */
+static int readahead_open(struct readahead *ra, struct cursor *c, off_t target, uintmax_t *id, uLong *crc)
+{
+	int ret;
+	struct point *here;
+	unsigned char discard[WINSIZE];
+
+	if (!ra->verify)
+		return cursor_open(c, ra->src, ra->index, target);
+	if( (here = findpoint(ra->index, target)) == NULL)
+		return Z_DATA_ERROR;
+	if( (ret = cursor_open(c, ra->src, ra->index, here->out)) != Z_OK)
+		return ret;
+	*id = here - ra->index->list;
+	*crc = crc32(0L, Z_NULL, 0);
+	while (c->out < target) {
+		ret = cursor_read(c, discard, (off_t)WINSIZE < target - c->out ? (int)WINSIZE : (int)(target - c->out));
+		if (ret <= 0) {
+			cursor_close(c);
+			return ret < 0 ? ret : Z_DATA_ERROR;
+		}
+		*crc = crc32_fast(*crc, discard, ret);
+	}
+	return Z_OK;
+}
+
+/* Fold len bytes decoded at offset out into the span CRCs, checking every
+   span they complete. */
+static int readahead_check(struct readahead *ra, const unsigned char *buf, int len, off_t out, uintmax_t *id, uLong *crc)
+{
+	int n;
+	off_t next;
+
+	while (0 < len) {
+		next = *id + 1 < ra->index->nelements ? ra->index->list[*id + 1].out : ra->totout;
+		n = next - out < len ? (int)(next - out) : len;
+		*crc = crc32_fast(*crc, buf, n);
+		buf += n;
+		out += n;
+		len -= n;
+		if (out == next) {
+			if ((uint32_t)*crc != ra->index->list[*id].crc)
+				return Z_DATA_ERROR;
+			*crc = crc32(0L, Z_NULL, 0);
+			(*id)++;
+		}
+	}
+	return Z_OK;
+}
+
+static void *readahead_worker(void *arg)
+{
+	struct readahead *ra = (struct readahead*)arg;
+	struct cursor c;
+	int opened = 0, ret = 0;
+	unsigned generation;
+	size_t pos, room;
+	off_t target;
+	uintmax_t id = 0;
+	uLong crc = 0;
+
+	pthread_mutex_lock(&ra->mutex);
+	for (;;) {
+		while (!ra->stop && (!ra->active || ra->eof || ra->used == ra->capacity))
+			pthread_cond_wait(&ra->cond, &ra->mutex);
+		if (ra->stop)
+			break;
+
+		/* decode into the free region after the buffered data; the reader
+		   never looks at it until it is published under the lock */
+		generation = ra->generation;
+		target = ra->begin + (off_t)ra->used;
+		pos = (ra->head + ra->used) % ra->capacity;
+		room = ra->capacity - ra->used;
+		if (ra->capacity - pos < room)
+			room = ra->capacity - pos;
+		if (READAHEAD_STEP < room)
+			room = READAHEAD_STEP;
+		pthread_mutex_unlock(&ra->mutex);
+
+		if (opened && c.out != target) {
+			cursor_close(&c);
+			opened = 0;
+		}
+		if (!opened) {
+			ret = readahead_open(ra, &c, target, &id, &crc);
+			opened = (ret == Z_OK);
+		}
+		if (opened) {
+			ret = cursor_read(&c, ra->ring + pos, (int)room);
+			if (0 < ret && ra->verify && readahead_check(ra, ra->ring + pos, ret, target, &id, &crc) != Z_OK)
+				ret = Z_DATA_ERROR;
+			if (ret < 0) {
+				cursor_close(&c);
+				opened = 0;
+			}
+		}
+
+		pthread_mutex_lock(&ra->mutex);
+		if (generation == ra->generation) {
+			if (0 < ret) {
+				ra->used += ret;
+			} else {
+				ra->eof = 1;
+				ra->error = ret;
+			}
+		}
+		pthread_cond_broadcast(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->mutex);
+
+	if (opened)
+		cursor_close(&c);
+	return NULL;
+}
+
+static void readahead_free(seekgzip_t *sz)
+{
+	struct readahead *ra = sz->readahead;
+
+	if (ra == NULL)
+		return;
+
+	pthread_mutex_lock(&ra->mutex);
+	ra->stop = 1;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->mutex);
+	pthread_join(ra->thread, NULL);
+
+	pthread_cond_destroy(&ra->cond);
+	pthread_mutex_destroy(&ra->mutex);
+	free(ra->ring);
+	free(ra);
+	sz->readahead = NULL;
+}
+
+/* Forget buffered data; the worker goes idle until the next restart. */
+static void readahead_cancel(struct readahead *ra)
+{
+	ra->active = 0;
+	ra->generation++;
+	ra->head = ra->used = 0;
+	ra->eof = ra->error = 0;
+}
+
+static int readahead_read(seekgzip_t *sz, unsigned char *buf, int size)
+{
+	struct readahead *ra = sz->readahead;
+	off_t offset = sz->offset;
+	size_t len;
+	int n = 0;
+
+	if (size <= 0)
+		return 0;
+
+	pthread_mutex_lock(&ra->mutex);
+	if (ra->active && ra->begin <= offset && offset <= ra->begin + (off_t)ra->used) {
+		/* drop whatever the caller skipped over */
+		len = (size_t)(offset - ra->begin);
+		ra->head = (ra->head + len) % ra->capacity;
+		ra->used -= len;
+		ra->begin = offset;
+
+		while (n < size) {
+			if (ra->used == 0) {
+				if (ra->eof)
+					break;
+				pthread_cond_wait(&ra->cond, &ra->mutex);
+				continue;
+			}
+			len = ra->used;
+			if ((size_t)(size - n) < len)
+				len = size - n;
+			if (ra->capacity - ra->head < len)
+				len = ra->capacity - ra->head;
+			memcpy(buf + n, ra->ring + ra->head, len);
+			ra->head = (ra->head + len) % ra->capacity;
+			ra->used -= len;
+			ra->begin += len;
+			n += len;
+			pthread_cond_broadcast(&ra->cond);
+		}
+		if (n == 0 && ra->error < 0)
+			n = ra->error;
+		if (0 < n)
+			ra->last = offset + n;
+		pthread_mutex_unlock(&ra->mutex);
+		return n;
+	}
+
+	/* a miss: restart the worker right behind this read when the access
+	   pattern looks sequential, otherwise just stop it */
+	ra->streak = (offset == ra->last) ? ra->streak + 1 : 0;
+	readahead_cancel(ra);
+	if (ra->streak) {
+		ra->active = 1;
+		ra->begin = offset + size;
+		pthread_cond_broadcast(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->mutex);
+
+	n = seekgzip_pread(sz, buf, size, offset);
+
+	pthread_mutex_lock(&ra->mutex);
+	if (0 < n)
+		ra->last = offset + n;
+	pthread_mutex_unlock(&ra->mutex);
+	return n;
+}
+
+int seekgzip_readahead(seekgzip_t *sz, int depth, size_t limit)
+{
+	struct readahead *ra;
+
+	readahead_free(sz);
+	if (depth <= 0)
+		return SEEKGZIP_SUCCESS;
+	if (sz->index == NULL)
+		return SEEKGZIP_ERROR;
+
+	if( (ra = (struct readahead*)calloc(1, sizeof(struct readahead))) == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+
+	ra->capacity = (size_t)depth * SPAN;
+	if (limit != 0 && limit < ra->capacity)
+		ra->capacity = limit < READAHEAD_STEP ? READAHEAD_STEP : limit;
+	ra->src = sz->src;
+	ra->index = sz->index;
+	ra->totout = sz->totout;
+	ra->verify = (sz->flags & SEEKGZIP_VERIFY) != 0;
+	ra->last = (off_t)-1;
+
+	if( (ra->ring = (unsigned char*)malloc(ra->capacity)) == NULL){
+		free(ra);
+		return SEEKGZIP_OUTOFMEMORY;
+	}
+	pthread_mutex_init(&ra->mutex, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+	if (pthread_create(&ra->thread, NULL, readahead_worker, ra) != 0) {
+		pthread_cond_destroy(&ra->cond);
+		pthread_mutex_destroy(&ra->mutex);
+		free(ra->ring);
+		free(ra);
+		return SEEKGZIP_ERROR;
+	}
+
+	sz->readahead = ra;
+	return SEEKGZIP_SUCCESS;
+}
+
+/*===== End of readahead ===== }}}*/
+
+/*===== Re-indexing ===== {{{*/
+
+/* seekgzip_reindex() derives an index with a different span from the
+   current one.  Every span longer than the new span is decoded from its own
+   access point on a worker thread (index_span()), so no span waits for the
+   one before it; then points closer than the new span to the previous one
+   are dropped, combining their CRCs. */
+
+struct reindex {
+	seekgzip_t            *sz;
+	off_t                  span;
+	pthread_mutex_t        mutex;
+	uintmax_t              next;		/* next span to decode */
+	struct access        **parts;		/* points of each decoded span */
+	int                    ret;
+};
+
+static void *reindex_worker(void *arg)
+{
+	struct reindex *r = (struct reindex*)arg;
+	seekgzip_t *sz = r->sz;
+	struct access *part;
+	uintmax_t id;
+	off_t end;
+	int ret;
+
+	for (;;) {
+		pthread_mutex_lock(&r->mutex);
+		id = r->next++;
+		ret = r->ret;
+		pthread_mutex_unlock(&r->mutex);
+		if (sz->index->nelements <= id || ret != Z_OK)
+			break;
+
+		end = span_end(sz, id);
+		if (end - sz->index->list[id].out <= r->span)
+			continue;
+		part = (struct access*)calloc(1, sizeof(struct access));
+		if (part == NULL || window_reserve(part, (uintmax_t)((end - sz->index->list[id].out) / r->span) + 1) != 0)
+			ret = Z_MEM_ERROR;
+		else
+			ret = index_span(sz->src, &sz->index->list[id], end, r->span, &part);
+		if (ret < 0) {
+			access_free(part);
+			pthread_mutex_lock(&r->mutex);
+			if (r->ret == Z_OK)
+				r->ret = ret;
+			pthread_mutex_unlock(&r->mutex);
+			break;
+		}
+		r->parts[id] = part;
+	}
+	return NULL;
+}
+
+int seekgzip_reindex(seekgzip_t *sz, off_t span, int nthreads)
+{
+	int i, started, ret = SEEKGZIP_SUCCESS;
+	uintmax_t id, n, k, spans;
+	size_t cache = 0, readahead = 0, checkpoints = 0;
+	off_t step = 0, len;
+	pthread_t *threads;
+	struct point *list, *p;
+	struct access *index = sz->index;
+	struct reindex r;
+
+	if (index == NULL || span <= 0)
+		return SEEKGZIP_ERROR;
+	if (nthreads < 1)
+		nthreads = 1;
+	spans = index->nelements;
+
+	memset(&r, 0, sizeof(r));
+	r.sz = sz;
+	r.span = span;
+	r.ret = Z_OK;
+	r.parts = (struct access**)calloc(index->nelements, sizeof(struct access*));
+	threads = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+	if (r.parts == NULL || threads == NULL) {
+		free(r.parts);
+		free(threads);
+		return SEEKGZIP_OUTOFMEMORY;
+	}
+	pthread_mutex_init(&r.mutex, NULL);
+
+	for (started = 0;started < nthreads;++started) {
+		if (pthread_create(&threads[started], NULL, reindex_worker, &r) != 0)
+			break;
+	}
+	if (started == 0)
+		reindex_worker(&r);
+	for (i = 0;i < started;++i)
+		pthread_join(threads[i], NULL);
+
+	if (r.ret != Z_OK) {
+		ret = r.ret == Z_MEM_ERROR ? SEEKGZIP_OUTOFMEMORY : r.ret == Z_ERRNO ? SEEKGZIP_READERROR : SEEKGZIP_DATAERROR;
+		goto error_exit;
+	}
+
+	/* splice the points of the decoded spans into the list */
+	for (id = 0, n = 0;id < index->nelements;++id)
+		n += r.parts[id] != NULL ? r.parts[id]->nelements : 1;
+	if( (list = p = (struct point*)malloc(sizeof(struct point) * n)) == NULL){
+		ret = SEEKGZIP_OUTOFMEMORY;
+		goto error_exit;
+	}
+	for (id = 0;id < index->nelements;++id) {
+		if (r.parts[id] != NULL) {
+			memcpy(p, r.parts[id]->list, sizeof(struct point) * r.parts[id]->nelements);
+			p += r.parts[id]->nelements;
+		} else {
+			*p++ = index->list[id];
+		}
+	}
+
+	/* drop points that are not more than span past the last one kept */
+	for (id = 1, k = 0;id < n;++id) {
+		if (span < list[id].out - list[k].out) {
+			if (++k != id)
+				list[k] = list[id];
+		} else if (index->crc) {
+			len = (id + 1 < n ? list[id + 1].out : sz->totout) - list[id].out;
+			list[k].crc = (uint32_t)crc32_combine(list[k].crc, list[id].crc, (z_off_t)len);
+		}
+	}
+	n = k + 1;
+
+	/* the workers and caches refer to access points; restart them */
+	if (sz->readahead != NULL)
+		readahead = sz->readahead->capacity;
+	if (sz->cache != NULL)
+		cache = sz->cache->limit;
+	if (sz->hot != NULL) {
+		step = sz->hot->step;
+		checkpoints = sz->hot->limit;
+	}
+	readahead_free(sz);
+	cache_free(sz);
+	hot_free(sz);
+
+	/* copy the kept points, and only their windows, into a fresh list */
+	if (access_replace(index, list, n) != 0)
+		ret = SEEKGZIP_OUTOFMEMORY;
+	free(list);
+
+	if (readahead && ret == SEEKGZIP_SUCCESS)
+		ret = seekgzip_readahead(sz, (int)((readahead + SPAN - 1) / SPAN), readahead);
+	if (cache && ret == SEEKGZIP_SUCCESS)
+		ret = seekgzip_cache(sz, cache);
+	if (checkpoints && ret == SEEKGZIP_SUCCESS)
+		ret = seekgzip_checkpoints(sz, step, checkpoints);
+	if (ret == SEEKGZIP_SUCCESS)
+		ret = seekgzip_index_save(sz);
+
+error_exit:
+	for (id = 0;id < spans;++id)
+		access_free(r.parts[id]);
+	pthread_mutex_destroy(&r.mutex);
+	free(r.parts);
+	free(threads);
+	return ret;
+}
+
+/*===== End of re-indexing ===== }}}*/
+
+/*===== Repacking ===== {{{*/
+
+/* seekgzip_repack() rewrites a file as a sequence of independent gzip
+   members, one per span (made of BGZF blocks when asked to), so that every
+   access point of the result is a member start and needs no window.  Spans
+   are decoded and compressed on worker threads and written in order by the
+   calling thread, with at most REPACK_AHEAD spans per thread in flight. */
+
+#define REPACK_AHEAD 2
+#define BGZF_BLOCK 65280		/* uncompressed bytes per BGZF block */
+
+static const unsigned char bgzf_eof[28] = {
+	0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+	0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00
+};
+
+/* A compressed span waiting to be written. */
+struct packed {
+	unsigned char         *data;
+	size_t                 size;
+	uLong                  crc;
+	int                    ready;
+};
+
+struct repack {
+	seekgzip_t            *sz;
+	int                    bgzf;
+	pthread_mutex_t        mutex;
+	pthread_cond_t         cond;
+	uintmax_t              next;		/* next span to compress */
+	uintmax_t              written;		/* spans written so far */
+	uintmax_t              ahead;		/* bound of next - written */
+	struct packed         *spans;
+	int                    ret;
+};
+
+static void put_uint32(unsigned char *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static uint32_t get_uint32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Compress len bytes at src into a gzip member (a BGZF block with bgzf) at
+   dst; returns its size, or 0 if it does not fit in avail bytes. */
+static size_t pack_member(z_stream *strm, unsigned char *dst, size_t avail,
+	const unsigned char *src, size_t len, int bgzf)
+{
+	size_t head = bgzf ? 18 : 10, size;
+
+	if (avail < head + 8 || deflateReset(strm) != Z_OK)
+		return 0;
+	strm->next_in = (Bytef*)src;
+	strm->avail_in = (uInt)len;
+	strm->next_out = dst + head;
+	strm->avail_out = (uInt)(avail - head - 8);
+	if (deflate(strm, Z_FINISH) != Z_STREAM_END)
+		return 0;
+	size = head + strm->total_out + 8;
+
+	memset(dst, 0, head);
+	dst[0] = 0x1f;
+	dst[1] = 0x8b;
+	dst[2] = Z_DEFLATED;
+	dst[9] = 3;				/* OS: Unix */
+	if (bgzf) {
+		dst[3] = 4;			/* FEXTRA */
+		dst[9] = 0xff;
+		dst[10] = 6;			/* XLEN */
+		dst[12] = 'B';
+		dst[13] = 'C';
+		dst[14] = 2;
+		dst[16] = (size - 1) & 0xff;
+		dst[17] = (size - 1) >> 8;
+	}
+	put_uint32(dst + size - 8, (uint32_t)crc32_fast(crc32(0L, Z_NULL, 0), src, len));
+	put_uint32(dst + size - 4, (uint32_t)len);
+	return size;
+}
+
+static void *repack_worker(void *arg)
+{
+	struct repack *r = (struct repack*)arg;
+	seekgzip_t *sz = r->sz;
+	struct cursor c;
+	struct packed p;
+	z_stream strm;
+	uintmax_t id;
+	off_t begin, end;
+	size_t len, done, piece, size, capacity;
+	unsigned char *buffer;
+	int ret;
+
+	memset(&strm, 0, sizeof(strm));
+	if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		pthread_mutex_lock(&r->mutex);
+		r->ret = SEEKGZIP_ZLIBERROR;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->mutex);
+		return NULL;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&r->mutex);
+		while (r->ret == SEEKGZIP_SUCCESS && r->next < sz->index->nelements &&
+			r->written + r->ahead <= r->next)
+			pthread_cond_wait(&r->cond, &r->mutex);
+		if (r->ret != SEEKGZIP_SUCCESS || sz->index->nelements <= r->next) {
+			pthread_mutex_unlock(&r->mutex);
+			break;
+		}
+		id = r->next++;
+		pthread_mutex_unlock(&r->mutex);
+
+		/* decode the span */
+		begin = sz->index->list[id].out;
+		end = span_end(sz, id);
+		len = (size_t)(end - begin);
+		memset(&p, 0, sizeof(p));
+		ret = SEEKGZIP_SUCCESS;
+		if( (buffer = (unsigned char*)malloc(len ? len : 1)) == NULL){
+			ret = SEEKGZIP_OUTOFMEMORY;
+		} else if (cursor_open(&c, sz->src, sz->index, begin) != Z_OK) {
+			ret = SEEKGZIP_DATAERROR;
+		} else {
+			for (done = 0;done < len;done += ret) {
+				piece = len - done < SPAN ? len - done : SPAN;
+				if( (ret = cursor_read(&c, buffer + done, (int)piece)) <= 0)
+					break;
+			}
+			cursor_close(&c);
+			ret = done == len ? SEEKGZIP_SUCCESS : SEEKGZIP_DATAERROR;
+		}
+		if (ret == SEEKGZIP_SUCCESS) {
+			p.crc = crc32_fast(crc32(0L, Z_NULL, 0), buffer, len);
+			if (sz->index->crc && (uint32_t)p.crc != sz->index->list[id].crc)
+				ret = SEEKGZIP_DATAERROR;
+		}
+
+		/* compress it into one member or a run of BGZF blocks */
+		if (ret == SEEKGZIP_SUCCESS) {
+			piece = r->bgzf ? BGZF_BLOCK : (len ? len : 1);
+			capacity = (len / piece + 1) * (deflateBound(&strm, piece) + 26);
+			if( (p.data = (unsigned char*)malloc(capacity)) == NULL)
+				ret = SEEKGZIP_OUTOFMEMORY;
+			done = 0;
+			do {
+				size = len - done < piece ? len - done : piece;
+				size = ret == SEEKGZIP_SUCCESS ?
+					pack_member(&strm, p.data + p.size, capacity - p.size, buffer + done, size, r->bgzf) : 0;
+				if (size == 0) {
+					if (ret == SEEKGZIP_SUCCESS)
+						ret = SEEKGZIP_ZLIBERROR;
+					break;
+				}
+				p.size += size;
+				done += piece;
+			} while (done < len);
+		}
+		free(buffer);
+
+		pthread_mutex_lock(&r->mutex);
+		if (ret == SEEKGZIP_SUCCESS) {
+			p.ready = 1;
+			r->spans[id] = p;
+		} else {
+			free(p.data);
+			if (r->ret == SEEKGZIP_SUCCESS)
+				r->ret = ret;
+		}
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->mutex);
+	}
+
+	(void)deflateEnd(&strm);
+	return NULL;
+}
+
+int seekgzip_repack(seekgzip_t *sz, const char *output, int nthreads, int bgzf)
+{
+	int i, started, ret;
+	uintmax_t id, n;
+	off_t offset = 0;
+	pthread_t *threads;
+	struct repack r;
+	struct point *points;
+	seekgzip_t *out;
+	FILE *fp;
+
+	if (sz->index == NULL)
+		return SEEKGZIP_ERROR;
+	if (nthreads < 1)
+		nthreads = 1;
+	n = sz->index->nelements;
+
+	memset(&r, 0, sizeof(r));
+	r.sz = sz;
+	r.bgzf = bgzf;
+	r.ahead = (uintmax_t)nthreads * REPACK_AHEAD;
+	r.ret = SEEKGZIP_SUCCESS;
+	r.spans = (struct packed*)calloc(n, sizeof(struct packed));
+	points = (struct point*)calloc(n, sizeof(struct point));
+	threads = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+	if (r.spans == NULL || points == NULL || threads == NULL) {
+		free(r.spans);
+		free(points);
+		free(threads);
+		return SEEKGZIP_OUTOFMEMORY;
+	}
+	if( (fp = fopen(output, "wb")) == NULL){
+		free(r.spans);
+		free(points);
+		free(threads);
+		return SEEKGZIP_OPENERROR;
+	}
+	pthread_mutex_init(&r.mutex, NULL);
+	pthread_cond_init(&r.cond, NULL);
+
+	for (started = 0;started < nthreads;++started) {
+		if (pthread_create(&threads[started], NULL, repack_worker, &r) != 0)
+			break;
+	}
+	if (started == 0)
+		r.ret = SEEKGZIP_ERROR;
+
+	/* write the spans in order as they become ready */
+	for (id = 0;id < n;++id) {
+		pthread_mutex_lock(&r.mutex);
+		while (!r.spans[id].ready && r.ret == SEEKGZIP_SUCCESS)
+			pthread_cond_wait(&r.cond, &r.mutex);
+		ret = r.ret;
+		pthread_mutex_unlock(&r.mutex);
+		if (ret != SEEKGZIP_SUCCESS)
+			break;
+
+		if (fwrite(r.spans[id].data, 1, r.spans[id].size, fp) != r.spans[id].size)
+			ret = SEEKGZIP_WRITEERROR;
+		points[id].out = sz->index->list[id].out;
+		points[id].in = offset;
+		points[id].bits = MEMBER_START;
+		points[id].crc = (uint32_t)r.spans[id].crc;
+		offset += r.spans[id].size;
+		free(r.spans[id].data);
+
+		pthread_mutex_lock(&r.mutex);
+		if (ret != SEEKGZIP_SUCCESS && r.ret == SEEKGZIP_SUCCESS)
+			r.ret = ret;
+		r.written++;
+		pthread_cond_broadcast(&r.cond);
+		pthread_mutex_unlock(&r.mutex);
+	}
+	for (i = 0;i < started;++i)
+		pthread_join(threads[i], NULL);
+	for (id = 0;id < n;++id) {
+		if (r.spans[id].ready && r.written <= id)
+			free(r.spans[id].data);
+	}
+	ret = r.ret;
+	if (ret == SEEKGZIP_SUCCESS && bgzf) {
+		if (fwrite(bgzf_eof, 1, sizeof(bgzf_eof), fp) != sizeof(bgzf_eof))
+			ret = SEEKGZIP_WRITEERROR;
+		offset += sizeof(bgzf_eof);
+	}
+	if (fclose(fp) != 0 && ret == SEEKGZIP_SUCCESS)
+		ret = SEEKGZIP_WRITEERROR;
+	pthread_cond_destroy(&r.cond);
+	pthread_mutex_destroy(&r.mutex);
+	free(r.spans);
+	free(threads);
+	if (ret != SEEKGZIP_SUCCESS) {
+		free(points);
+		return ret;
+	}
+
+	/* save the index of the output: member starts only */
+	if( (out = (seekgzip_t*)calloc(1, sizeof(seekgzip_t))) == NULL ||
+		(out->index = (struct access*)calloc(1, sizeof(struct access))) == NULL){
+		free(out);
+		free(points);
+		return SEEKGZIP_OUTOFMEMORY;
+	}
+	if (access_replace(out->index, points, n) != 0) {
+		free(points);
+		seekgzip_close(out);
+		return SEEKGZIP_OUTOFMEMORY;
+	}
+	free(points);
+	out->index->crc = 1;
+	out->index->members = 1;
+	out->index->tar = sz->index->tar;	/* same uncompressed offsets */
+	out->totin = offset;
+	out->totout = sz->totout;
+	out->src = seekgzip_source_file(output);
+	out->path_index = get_index_file(output);
+	ret = out->src == NULL ? SEEKGZIP_OPENERROR : out->path_index == NULL ?
+		SEEKGZIP_OUTOFMEMORY : seekgzip_index_save(out);
+	out->index->tar = NULL;
+	seekgzip_close(out);
+	return ret;
+}
+
+/*===== End of repacking ===== }}}*/
+
+/*===== Sampling ===== {{{*/
+
+/* seekgzip_sample() draws k uniform offsets in the uncompressed data and
+   reports the record (delimiter-terminated) containing each of them.  The
+   offsets are sorted and grouped by the span they fall in, and every span
+   with samples is decoded once, in full, on one of the worker threads.
+   Records inside a span are cut out right away; of the span itself only the
+   head (up to its first delimiter) and the tail (after its last delimiter)
+   are kept, and records that cross span ends are put together from these
+   pieces afterwards, in file order.  A neighbouring span without samples is
+   decoded (once, in a further round) only when such a record runs into it.
+   Records come out in file order, each once, whatever the number of
+   threads; so the choice of records is uniform over bytes, i.e. a record is
+   drawn with probability proportional to its length, and fewer than k
+   records are reported when several offsets hit the same record. */
+
+struct sample {
+	off_t                  offset;		/* the drawn offset */
+	off_t                  start;		/* start of its record, or -1 if it crosses a span end */
+	int                    head;		/* crossing the start of its span */
+	unsigned char         *data;		/* the record, for the first sample in it */
+	size_t                 size;
+};
+
+/* What a decoded span contributes to the records that cross its ends. */
+struct piece {
+	uintmax_t              id;
+	int                    first, last;	/* its samples */
+	int                    back, fwd;	/* a record runs in from before, out past the end */
+	int                    decoded;
+	int                    whole;		/* no delimiter: head holds the whole span */
+	unsigned char         *head;		/* up to and including the first delimiter */
+	size_t                 hlen;
+	unsigned char         *tail;		/* after the last delimiter */
+	size_t                 tlen;
+};
+
+struct sampler {
+	seekgzip_t            *sz;
+	int                    delim;
+	struct sample         *samples;
+	int                    k;
+	struct piece          *pieces;		/* sorted by id, decoded */
+	size_t                 npieces, cpieces;
+	struct piece          *todo;		/* to decode in the next round */
+	size_t                 ntodo, ctodo;
+	size_t                 next;		/* next piece of todo to decode */
+	pthread_mutex_t        mutex;
+	int                    ret;
+};
+
+static unsigned char *sample_copy(const unsigned char *p, size_t n)
+{
+	unsigned char *q = (unsigned char*)malloc(n ? n : 1);
+	if (q != NULL)
+		memcpy(q, p, n);
+	return q;
+}
+
+/* Decode span pc->id, cut out the records of its samples inside the span,
+   and keep its head and tail. */
+static int sample_span(struct sampler *sp, struct piece *pc)
+{
+	seekgzip_t *sz = sp->sz;
+	off_t begin = sz->index->list[pc->id].out;
+	size_t i, len = (size_t)(span_end(sz, pc->id) - begin), got = 0, rel, a, b, first, last;
+	unsigned char *data, *p;
+	struct sample *x;
+	struct cursor c;
+	int ret = Z_OK, n;
+
+	if( (data = (unsigned char*)malloc(len ? len : 1)) == NULL)
+		return Z_MEM_ERROR;
+	if( (ret = cursor_open(&c, sz->src, sz->index, begin)) != Z_OK){
+		free(data);
+		return ret;
+	}
+	while (got < len) {
+		n = cursor_read(&c, data + got, len - got < INT_MAX ? (int)(len - got) : INT_MAX);
+		if (n <= 0) {
+			ret = n < 0 ? n : Z_DATA_ERROR;
+			break;
+		}
+		got += n;
+	}
+	cursor_close(&c);
+	if (ret != Z_OK) {
+		free(data);
+		return ret;
+	}
+
+	if( (p = (unsigned char*)memchr(data, sp->delim, len)) == NULL){
+		pc->whole = 1;
+		pc->head = data;
+		pc->hlen = len;
+		for (i = pc->first;i < (size_t)pc->last;++i)
+			sp->samples[i].start = -1;
+		return Z_OK;
+	}
+	first = p - data;
+	for (last = len - 1;data[last] != sp->delim;--last)
+		;
+	pc->hlen = first + 1;
+	pc->tlen = len - last - 1;
+	if( (pc->head = sample_copy(data, pc->hlen)) == NULL ||
+		(pc->tail = sample_copy(data + last + 1, pc->tlen)) == NULL){
+		free(data);
+		return Z_MEM_ERROR;
+	}
+
+	b = first + 1;		/* end of the record cut out last */
+	for (i = pc->first;i < (size_t)pc->last;++i) {
+		x = &sp->samples[i];
+		rel = (size_t)(x->offset - begin);
+		if (rel <= first) {
+			x->start = -1;
+			x->head = 1;
+			continue;
+		}
+		if (last < rel) {
+			x->start = -1;
+			continue;
+		}
+		if (rel < b) {
+			/* in the record cut out before */
+			x->start = x[-1].start;
+			continue;
+		}
+		for (a = rel;b < a && data[a - 1] != sp->delim;--a)
+			;
+		b = (unsigned char*)memchr(data + rel, sp->delim, len - rel) - data + 1;
+		x->start = begin + (off_t)a;
+		x->size = b - a;
+		if( (x->data = sample_copy(data + a, b - a)) == NULL){
+			free(data);
+			return Z_MEM_ERROR;
+		}
+	}
+	free(data);
+
+	/* the span ends any record that runs into it; only its own samples
+	   need the neighbours */
+	pc->back = pc->fwd = 0;
+	for (i = pc->first;i < (size_t)pc->last;++i) {
+		if (sp->samples[i].head)
+			pc->back = 1;
+		else if (sp->samples[i].start < 0)
+			pc->fwd = 1;
+	}
+	return Z_OK;
+}
+
+static void *sample_worker(void *arg)
+{
+	struct sampler *sp = (struct sampler*)arg;
+	size_t i;
+	int ret;
+
+	for (;;) {
+		pthread_mutex_lock(&sp->mutex);
+		i = sp->ret == Z_OK ? sp->next++ : sp->ntodo;
+		pthread_mutex_unlock(&sp->mutex);
+		if (sp->ntodo <= i)
+			break;
+
+		if( (ret = sample_span(sp, &sp->todo[i])) != Z_OK){
+			pthread_mutex_lock(&sp->mutex);
+			if (sp->ret == Z_OK)
+				sp->ret = ret;
+			pthread_mutex_unlock(&sp->mutex);
+		}
+	}
+	return NULL;
+}
+
+/* Decode the spans in todo on nthreads threads. */
+static int sample_round(struct sampler *sp, pthread_t *threads, int nthreads)
+{
+	int i, started;
+
+	sp->next = 0;
+	for (started = 0;started < nthreads && (size_t)started < sp->ntodo;++started) {
+		if (pthread_create(&threads[started], NULL, sample_worker, sp) != 0)
+			break;
+	}
+	if (started == 0)
+		sample_worker(sp);
+	for (i = 0;i < started;++i)
+		pthread_join(threads[i], NULL);
+	return sp->ret;
+}
+
+static int compare_pieces(const void *x, const void *y)
+{
+	const struct piece *a = (const struct piece*)x, *b = (const struct piece*)y;
+	return (a->id > b->id) - (a->id < b->id);
+}
+
+static struct piece *sample_find(struct sampler *sp, uintmax_t id)
+{
+	struct piece key;
+
+	key.id = id;
+	return (struct piece*)bsearch(&key, sp->pieces, sp->npieces, sizeof(struct piece), compare_pieces);
+}
+
+/* A record runs from span id into its neighbour in direction dir (-1 or 1):
+   queue the neighbour for decoding unless it was decoded already, and go
+   on through decoded spans without a delimiter. */
+static int sample_want(struct sampler *sp, uintmax_t id, int dir)
+{
+	struct piece *pc;
+
+	for (;;) {
+		if ((dir < 0 && id == 0) || (0 < dir && sp->sz->index->nelements <= id + 1))
+			return Z_OK;
+		id += dir;
+		if( (pc = sample_find(sp, id)) == NULL)
+			break;
+		if (!pc->whole || (dir < 0 ? pc->back : pc->fwd))
+			return Z_OK;
+		if (dir < 0)
+			pc->back = 1;
+		else
+			pc->fwd = 1;
+	}
+
+	if (sp->ntodo == sp->ctodo) {
+		size_t cap = sp->ctodo ? sp->ctodo * 2 : 16;
+		if( (pc = (struct piece*)realloc(sp->todo, sizeof(struct piece) * cap)) == NULL)
+			return Z_MEM_ERROR;
+		sp->todo = pc;
+		sp->ctodo = cap;
+	}
+	pc = &sp->todo[sp->ntodo++];
+	memset(pc, 0, sizeof(*pc));
+	pc->id = id;
+	if (dir < 0)
+		pc->back = 1;
+	else
+		pc->fwd = 1;
+	return Z_OK;
+}
+
+/* Sort todo and drop duplicates, so that no span is decoded twice. */
+static void sample_unique(struct sampler *sp)
+{
+	size_t i, n = 0;
+
+	qsort(sp->todo, sp->ntodo, sizeof(struct piece), compare_pieces);
+	for (i = 0;i < sp->ntodo;++i) {
+		if (0 < n && sp->todo[n - 1].id == sp->todo[i].id) {
+			sp->todo[n - 1].back |= sp->todo[i].back;
+			sp->todo[n - 1].fwd |= sp->todo[i].fwd;
+			continue;
+		}
+		sp->todo[n++] = sp->todo[i];
+	}
+	sp->ntodo = n;
+}
+
+/* Move the decoded spans of todo into pieces, and queue the neighbours that
+   records crossing their ends need. */
+static int sample_merge(struct sampler *sp)
+{
+	size_t i, n = sp->ntodo, cap;
+	struct piece *pc;
+	int ret;
+
+	if (sp->cpieces < sp->npieces + n) {
+		cap = sp->npieces + n;
+		if( (pc = (struct piece*)realloc(sp->pieces, sizeof(struct piece) * cap)) == NULL)
+			return Z_MEM_ERROR;
+		sp->pieces = pc;
+		sp->cpieces = cap;
+	}
+	memcpy(sp->pieces + sp->npieces, sp->todo, sizeof(struct piece) * n);
+	sp->npieces += n;
+	qsort(sp->pieces, sp->npieces, sizeof(struct piece), compare_pieces);
+	sp->ntodo = 0;
+
+	/* samples in a span without a delimiter need both neighbours */
+	for (i = 0;i < sp->npieces;++i) {
+		pc = &sp->pieces[i];
+		if (pc->decoded)
+			continue;
+		pc->decoded = 1;
+		if (pc->whole && pc->first < pc->last)
+			pc->back = pc->fwd = 1;
+	}
+	for (i = 0;i < sp->npieces;++i) {
+		pc = &sp->pieces[i];
+		if (pc->back && (ret = sample_want(sp, pc->id, -1)) != Z_OK)
+			return ret;
+		if (pc->fwd && (ret = sample_want(sp, pc->id, 1)) != Z_OK)
+			return ret;
+	}
+	return Z_OK;
+}
+static int compare_samples(const void *x, const void *y)
+{
+	const struct sample *a = (const struct sample*)x, *b = (const struct sample*)y;
+	return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+/* splitmix64 */
+static uint64_t sample_random(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static int sample_append(unsigned char **rec, size_t *len, size_t *cap, const unsigned char *p, size_t n)
+{
+	if (*cap < *len + n) {
+		size_t size = *cap ? *cap : 256;
+		unsigned char *q;
+		while (size < *len + n)
+			size *= 2;
+		if( (q = (unsigned char*)realloc(*rec, size)) == NULL)
+			return Z_MEM_ERROR;
+		*rec = q;
+		*cap = size;
+	}
+	memcpy(*rec + *len, p, n);
+	*len += n;
+	return Z_OK;
+}
+
+/* Hand a record to the samples [first, last) that fall in it. */
+static int sample_give(struct sampler *sp, int first, int last, const unsigned char *rec, size_t len, off_t start)
+{
+	int i;
+
+	if (last <= first)
+		return Z_OK;
+	for (i = first;i < last;++i)
+		sp->samples[i].start = start;
+	sp->samples[first].size = len;
+	if( (sp->samples[first].data = sample_copy(rec, len)) == NULL)
+		return Z_MEM_ERROR;
+	return Z_OK;
+}
+
+/* Put together the records that cross span ends from the heads and tails of
+   the decoded spans, in file order.  The samples waiting for the record in
+   progress are always the consecutive range [pfirst, pend). */
+static int sample_join(struct sampler *sp)
+{
+	size_t i, rlen = 0, rcap = 0;
+	int h, t, pfirst = 0, pend = 0, ret = Z_OK;
+	off_t rstart = 0;
+	unsigned char *rec = NULL;
+	struct piece *pc;
+
+	for (i = 0;i < sp->npieces && ret == Z_OK;++i) {
+		pc = &sp->pieces[i];
+		if (i == 0 || sp->pieces[i - 1].id + 1 != pc->id) {
+			/* nothing runs in from a span that was not decoded */
+			rlen = 0;
+			rstart = sp->sz->index->list[pc->id].out;
+			pfirst = pend = 0;
+		}
+		if( (ret = sample_append(&rec, &rlen, &rcap, pc->head, pc->hlen)) != Z_OK)
+			break;
+
+		if (pc->whole) {
+			if (pc->first < pc->last) {
+				if (pfirst == pend)
+					pfirst = pc->first;
+				pend = pc->last;
+			}
+			continue;
+		}
+
+		/* the head completes the record in progress */
+		for (h = pc->first;h < pc->last && sp->samples[h].head;++h)
+			;
+		if (pc->first < h) {
+			if (pfirst == pend)
+				pfirst = pc->first;
+			pend = h;
+		}
+		ret = sample_give(sp, pfirst, pend, rec, rlen, rstart);
+
+		/* and the tail starts the next one */
+		for (t = pc->last;h < t && sp->samples[t - 1].start < 0;--t)
+			;
+		pfirst = t;
+		pend = pc->last;
+		rlen = 0;
+		rstart = span_end(sp->sz, pc->id) - (off_t)pc->tlen;
+		if (ret == Z_OK)
+			ret = sample_append(&rec, &rlen, &rcap, pc->tail, pc->tlen);
+	}
+
+	/* the last record of the data needs no delimiter */
+	if (ret == Z_OK)
+		ret = sample_give(sp, pfirst, pend, rec, rlen, rstart);
+	free(rec);
+	return ret;
+}
+
+int seekgzip_sample(seekgzip_t *sz, int k, unsigned long seed, int delim, int nthreads,
+	seekgzip_sample_callback callback, void *instance)
+{
+	int i, ret;
+	size_t j;
+	off_t reported = -1;
+	uint64_t state = seed;
+	uintmax_t id;
+	pthread_t *threads;
+	struct piece *pc;
+	struct sampler sp;
+
+	if (sz->index == NULL || k < 0)
+		return SEEKGZIP_ERROR;
+	if (k == 0 || sz->totout == 0)
+		return SEEKGZIP_SUCCESS;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	memset(&sp, 0, sizeof(sp));
+	sp.sz = sz;
+	sp.delim = (unsigned char)delim;
+	sp.k = k;
+	sp.ret = Z_OK;
+	sp.samples = (struct sample*)calloc(k, sizeof(struct sample));
+	sp.ctodo = (uintmax_t)k < sz->index->nelements ? (size_t)k : (size_t)sz->index->nelements;
+	sp.todo = (struct piece*)calloc(sp.ctodo, sizeof(struct piece));
+	threads = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+	if (sp.samples == NULL || sp.todo == NULL || threads == NULL) {
+		free(sp.samples);
+		free(sp.todo);
+		free(threads);
+		return SEEKGZIP_OUTOFMEMORY;
+	}
+
+	/* draw and sort the offsets, then split them by span */
+	for (i = 0;i < k;++i)
+		sp.samples[i].offset = (off_t)(sample_random(&state) % (uint64_t)sz->totout);
+	qsort(sp.samples, k, sizeof(struct sample), compare_samples);
+	for (i = 0;i < k;++i) {
+		id = findpoint(sz->index, sp.samples[i].offset) - sz->index->list;
+		if (i == 0 || id != sp.todo[sp.ntodo - 1].id) {
+			pc = &sp.todo[sp.ntodo++];
+			pc->id = id;
+			pc->first = i;
+		}
+		sp.todo[sp.ntodo - 1].last = i + 1;
+	}
+
+	/* decode the spans with samples, then the neighbours that records
+	   crossing their ends run into, and so on */
+	pthread_mutex_init(&sp.mutex, NULL);
+	while (sp.ret == Z_OK && 0 < sp.ntodo) {
+		sample_unique(&sp);
+		if (sample_round(&sp, threads, nthreads) == Z_OK)
+			sp.ret = sample_merge(&sp);
+	}
+	pthread_mutex_destroy(&sp.mutex);
+	if (sp.ret == Z_OK)
+		sp.ret = sample_join(&sp);
+
+	ret = sp.ret == Z_OK ? SEEKGZIP_SUCCESS : sp.ret == Z_MEM_ERROR ? SEEKGZIP_OUTOFMEMORY :
+		sp.ret == Z_ERRNO ? SEEKGZIP_READERROR : SEEKGZIP_DATAERROR;
+	for (i = 0;i < k;++i) {
+		if (ret == SEEKGZIP_SUCCESS && sp.samples[i].data != NULL &&
+			sp.samples[i].start != reported && callback != NULL)
+			callback(instance, sp.samples[i].start, sp.samples[i].data, sp.samples[i].size);
+		if (sp.samples[i].data != NULL)
+			reported = sp.samples[i].start;
+		free(sp.samples[i].data);
+	}
+	for (j = 0;j < sp.npieces;++j) {
+		free(sp.pieces[j].head);
+		free(sp.pieces[j].tail);
+	}
+	for (j = 0;j < sp.ntodo;++j) {
+		free(sp.todo[j].head);
+		free(sp.todo[j].tail);
+	}
+	free(sp.samples);
+	free(sp.pieces);
+	free(sp.todo);
+	free(threads);
+	return ret;
+}
+
+/*===== End of sampling ===== }}}*/
+
+/* The index lives beside the data as "$FILE.idx", or, when the environment
+   variable SEEKGZIP_INDEX_DIR names a directory, in that directory under the
+   base name of the file and a hash of its absolute path (or URL). */
+static char *get_index_file(const char *target)
+{
+	char *idx, *key;
+	const char *dir = getenv("SEEKGZIP_INDEX_DIR"), *base;
+	uint64_t hash = 14695981039346656037ULL;	/* FNV-1a */
+	size_t i, size;
+
+	if (dir == NULL || *dir == 0) {
+		idx = (char*)malloc(strlen(target) + 4 + 1);
+		if (idx == NULL) {
+			return NULL;
+		}
+		strcpy(idx, target);
+		strcat(idx, ".idx");
+		return idx;	
+	}
+
+	key = seekgzip_is_url(target) ? NULL : realpath(target, NULL);
+	if (key == NULL && (key = strdup(target)) == NULL)
+		return NULL;
+	for (i = 0;key[i];++i) {
+		hash ^= (unsigned char)key[i];
+		hash *= 1099511628211ULL;
+	}
+	base = strrchr(key, '/') != NULL ? strrchr(key, '/') + 1 : key;
+
+	size = strlen(dir) + 1 + strlen(base) + 1 + 16 + 4 + 1;
+	if( (idx = (char*)malloc(size)) != NULL)
+		snprintf(idx, size, "%s/%s-%016jx.idx", dir, base, (uintmax_t)hash);
+	free(key);
+	return idx;
+}
+
+/* Fingerprint of the compressed data, cheap enough to compute on every open:
+   a CRC-32 of the first and last FINGERPRINT_SIZE bytes of the file and of
+   FINGERPRINT_SAMPLE bytes at up to FINGERPRINT_POINTS access points. */
+#define FINGERPRINT_SIZE 65536
+#define FINGERPRINT_SAMPLE 4096
+#define FINGERPRINT_POINTS 8
+
+static int crc_range(seekgzip_source_t *src, off_t offset, off_t size, uLong *crc)
+{
+	ssize_t got;
+	unsigned char buffer[CHUNK];
+
+	while (0 < size) {
+		got = src->read_at(src, buffer, CHUNK < size ? CHUNK : (size_t)size, offset);
+		if (got <= 0)
+			return got < 0 ? SEEKGZIP_READERROR : SEEKGZIP_SUCCESS;
+		*crc = crc32(*crc, buffer, (uInt)got);
+		offset += got;
+		size -= got;
+	}
+	return SEEKGZIP_SUCCESS;
+}
+
+/* The access point sampled k-th of n for the fingerprint. */
+static uintmax_t fingerprint_point(int k, uintmax_t n)
+{
+	return n <= FINGERPRINT_POINTS ? (uintmax_t)k : k * (n - 1) / (FINGERPRINT_POINTS - 1);
+}
+
+/* The fingerprint of src, given the input offsets of the k sampled points. */
+static int source_fingerprint(seekgzip_source_t *src, const off_t *in, int k, uint32_t *fingerprint)
+{
+	int ret, j;
+	off_t size = src->size(src);
+	uLong crc = crc32(0L, Z_NULL, 0);
+
+	if (size < 0)
+		return SEEKGZIP_READERROR;
+	if( (ret = crc_range(src, 0, FINGERPRINT_SIZE, &crc)) != SEEKGZIP_SUCCESS)
+		return ret;
+	if( (ret = crc_range(src, size < FINGERPRINT_SIZE ? 0 : size - FINGERPRINT_SIZE, FINGERPRINT_SIZE, &crc)) != SEEKGZIP_SUCCESS)
+		return ret;
+	for (j = 0;j < k;++j) {
+		if( (ret = crc_range(src, in[j], FINGERPRINT_SAMPLE, &crc)) != SEEKGZIP_SUCCESS)
+			return ret;
+	}
+	*fingerprint = (uint32_t)crc;
+	return SEEKGZIP_SUCCESS;
+}
+
+static int index_fingerprint(seekgzip_t *sz, uint32_t *fingerprint)
+{
+	int k;
+	uintmax_t n = sz->index->nelements;
+	off_t in[FINGERPRINT_POINTS];
+
+	for (k = 0;k < FINGERPRINT_POINTS && (uintmax_t)k < n;++k)
+		in[k] = sz->index->list[fingerprint_point(k, n)].in;
+	return source_fingerprint(sz->src, in, k, fingerprint);
+}
+
+/* Optional sections of a version 3 or 4 index, flagged in its header.
+   Version 4 only widens the number of points to 64 bits. */
+#define INDEX_CRC 0x0001		/* a CRC-32 per access point */
+#define INDEX_MEMBERS 0x0002		/* several gzip members; MEMBER_START points
+					   are stored without a window */
+#define INDEX_TAR 0x0004		/* tar members, after the points */
+#define INDEX_FEATURES (INDEX_CRC | INDEX_MEMBERS | INDEX_TAR)
+
+static int write_uint32(gzFile gz, uint32_t v)
+{
+	return gzwrite(gz, &v, sizeof(v));
+}
+
+static uint32_t read_uint32(gzFile gz)
+{
+	uint32_t v;
+	gzread(gz, &v, sizeof(v));
+	return v;
+}
+
+static int write_uint64(gzFile gz, uint64_t v)
+{
+	return gzwrite(gz, &v, sizeof(v));
+}
+
+static uint64_t read_uint64(gzFile gz)
+{
+	uint64_t v = 0;
+	gzread(gz, &v, sizeof(v));
+	return v;
+}
+
+void seekgzip_index_free(seekgzip_t *sz){
+	if(sz->index == NULL)
+		return;
+	
+	access_free(sz->index);
+	sz->index = NULL;
+}
+
+int seekgzip_index_alloc(seekgzip_t *sz){
+	if(sz->index != NULL)
+		seekgzip_index_free(sz);
 	
 	if( (sz->index = (struct access *)malloc(sizeof(struct access))) == NULL)
 		return SEEKGZIP_OUTOFMEMORY;
 	
 	sz->index->nelements = 0;
 	sz->index->allocated = 0;
+	sz->index->crc = 0;
+	sz->index->members = 0;
 	sz->index->list	     = NULL;
+	sz->index->out	     = NULL;
+	sz->index->windows   = NULL;
+	sz->index->tar	     = NULL;
 	return SEEKGZIP_SUCCESS;
 }
 
+/* Download a remote index into an anonymous temporary file and open it. */
+static gzFile open_remote_index(seekgzip_source_t *src)
+{
+	int fd;
+	off_t pos = 0;
+	ssize_t got;
+	char buffer[CHUNK];
+	gzFile gz = NULL;
+	FILE *tmp;
+
+	if( (tmp = tmpfile()) == NULL)
+		return NULL;
+	while ((got = src->read_at(src, buffer, CHUNK, pos)) > 0) {
+		if (fwrite(buffer, 1, got, tmp) != (size_t)got)
+			break;
+		pos += got;
+	}
+	if (got == 0 && fflush(tmp) == 0 && (fd = dup(fileno(tmp))) != -1) {
+		lseek(fd, 0, SEEK_SET);
+		if( (gz = gzdopen(fd, "rb")) == NULL)
+			close(fd);
+	}
+	fclose(tmp);
+	return gz;
+}
+
 int seekgzip_index_checkutime(seekgzip_t *sz){
 	int                    ret;
-	struct stat            stats_data;
+	time_t                 mtime_data;
+	time_t                 mtime_index;
 	struct stat            stats_index;
+	seekgzip_source_t     *src;
 	
-	if( (ret = stat(sz->path_data, &stats_data)) != 0)
-		return ret;
+	mtime_data = sz->src->mtime(sz->src);
+
+	// A remote index cannot be stamped, it only has to be newer than the data.
+	if (seekgzip_is_url(sz->path_index)) {
+		if( (src = seekgzip_source_http(sz->path_index)) == NULL)
+			return -1;
+		mtime_index = src->mtime(src);
+		src->close(src);
+		if (mtime_data == (time_t)-1 || mtime_index == (time_t)-1)
+			return 0;
+		return (mtime_data <= mtime_index) ? 0 : 1;
+	}
+
 	if( (ret = stat(sz->path_index, &stats_index)) != 0)
 		return ret;
 	
-	return (stats_data.st_mtime == stats_index.st_mtime) ?
+	return (mtime_data == stats_index.st_mtime) ?
 		0 : 1;
 }
 
 int seekgzip_index_setutime(seekgzip_t *sz){
 	int                    ret;
-	struct stat            stats;
 	struct utimbuf         times;
 	
-	if( (ret = stat(sz->path_data, &stats)) != 0)
-		return ret;
+	if (seekgzip_is_url(sz->path_index))
+		return -1;
 	
-	times.actime  = stats.st_atime;
-	times.modtime = stats.st_mtime;
+	times.actime  = sz->src->mtime(sz->src);
+	times.modtime = times.actime;
 	
 	if( (ret = utime(sz->path_index, &times)) != 0)
 		return ret;
@@ -478,18 +3368,26 @@ int seekgzip_index_build(seekgzip_t *sz)
 {
 	int len, ret = SEEKGZIP_SUCCESS;
 
+	// Start from an empty list; a failed load may have left entries behind.
+	if( (ret = seekgzip_index_alloc(sz)) != SEEKGZIP_SUCCESS)
+		return ret;
+
 	// Build an index for the file.
-	len = build_index(sz->fp, SPAN, &sz->index, sz);
+	len = build_index(sz->src, SPAN, &sz->index, sz);
 	if (len < 0) {
 		switch (len) {
 		case Z_MEM_ERROR:
 			ret = SEEKGZIP_OUTOFMEMORY;
+			break;
 		case Z_DATA_ERROR:
 			ret = SEEKGZIP_DATAERROR;
+			break;
 		case Z_ERRNO:
 			ret = SEEKGZIP_READERROR;
+			break;
 		default:
 			ret = SEEKGZIP_ERROR;
+			break;
 		}
 	
 		// invalid index, so - free it
@@ -501,26 +3399,56 @@ int seekgzip_index_build(seekgzip_t *sz)
 int seekgzip_index_save(seekgzip_t *sz){
 	int ret = SEEKGZIP_SUCCESS;
 	uintmax_t i;
+	uint32_t fingerprint;
+	off_t size;
 	gzFile gz;
 
+	if (sz->path_index == NULL || seekgzip_is_url(sz->path_index))
+		return SEEKGZIP_WRITEERROR;
+	if( (ret = index_fingerprint(sz, &fingerprint)) != SEEKGZIP_SUCCESS)
+		return ret;
+	size = sz->src->size(sz->src);
+
 	// Open the index file for writing.
 	gz = gzopen(sz->path_index, "wb");
 	if (gz == NULL)
 		return SEEKGZIP_OPENERROR;
 
 	// Write a header.
-	gzwrite(gz, "ZSE2", 4);
+	gzwrite(gz, "ZSE4", 4);
 	write_uint32(gz, (uint32_t)sizeof(off_t));
-	write_uint32(gz, (uint32_t)sz->index->nelements);
+	write_uint32(gz, (sz->index->crc ? INDEX_CRC : 0) | (sz->index->members ? INDEX_MEMBERS : 0) |
+		(sz->index->tar != NULL ? INDEX_TAR : 0));
+	write_uint64(gz, (uint64_t)sz->index->nelements);
 	gzwrite(gz, &sz->totin,  sizeof(off_t));
 	gzwrite(gz, &sz->totout, sizeof(off_t));
+
+	// Write the size and fingerprint of the compressed data.
+	gzwrite(gz, &size, sizeof(off_t));
+	write_uint32(gz, fingerprint);
 	
 	// Write out entry points.
 	for (i = 0;i < sz->index->nelements;++i) {
 		gzwrite(gz, &sz->index->list[i].out, sizeof(off_t));
 		gzwrite(gz, &sz->index->list[i].in, sizeof(off_t));
 		gzwrite(gz, &sz->index->list[i].bits, sizeof(int));
-		gzwrite(gz, sz->index->list[i].window, WINSIZE);
+		if (sz->index->crc)
+			write_uint32(gz, sz->index->list[i].crc);
+		if (sz->index->list[i].bits != MEMBER_START)
+			gzwrite(gz, sz->index->list[i].window, WINSIZE);
+	}
+
+	// Write out tar members: offset, size, type, name length and name.
+	if (sz->index->tar != NULL) {
+		struct tar *t = sz->index->tar;
+		write_uint64(gz, (uint64_t)t->n);
+		for (i = 0;i < t->n;++i) {
+			write_uint64(gz, (uint64_t)t->members[i].offset);
+			write_uint64(gz, (uint64_t)t->members[i].size);
+			write_uint32(gz, (uint32_t)t->members[i].type);
+			write_uint32(gz, (uint32_t)strlen(t->members[i].name));
+			gzwrite(gz, t->members[i].name, strlen(t->members[i].name));
+		}
 	}
 
 	gzclose(gz);
@@ -529,31 +3457,75 @@ int seekgzip_index_save(seekgzip_t *sz){
 	return ret;
 }
 
+static int load_tar(gzFile gz, struct access *index)
+{
+	uint64_t i, n = read_uint64(gz);
+	uint32_t len;
+	struct tar *t;
+	struct tar_member *m;
+
+	if (n == 0 || SIZE_MAX / sizeof(struct tar_member) <= n)
+		return SEEKGZIP_IMCOMPATIBLE;
+	if( (t = index->tar = (struct tar*)calloc(1, sizeof(struct tar))) == NULL ||
+		(t->members = (struct tar_member*)malloc(sizeof(struct tar_member) * n)) == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+	t->allocated = n;
+	for (i = 0;i < n;++i) {
+		m = &t->members[i];
+		m->offset = (off_t)read_uint64(gz);
+		m->size = (off_t)read_uint64(gz);
+		m->type = (int)read_uint32(gz);
+		len = read_uint32(gz);
+		if (TAR_EXTENDED < len)
+			return SEEKGZIP_IMCOMPATIBLE;
+		if( (m->name = (char*)malloc(len + 1)) == NULL)
+			return SEEKGZIP_OUTOFMEMORY;
+		t->n = i + 1;
+		if (gzread(gz, m->name, len) != (int)len)
+			return SEEKGZIP_IMCOMPATIBLE;
+		m->name[len] = 0;
+	}
+	return SEEKGZIP_SUCCESS;
+}
+
+/* An index is valid if it was built from a file of the same size and
+   fingerprint.  Matching modification times of the file and the index are
+   taken as a shortcut unless SEEKGZIP_STRICT is given; after a successful
+   fingerprint check the index is stamped again so the shortcut applies
+   next time.  Version 2 indexes only carry the modification time. */
 int seekgzip_index_load(seekgzip_t *sz){
-	int ret = SEEKGZIP_SUCCESS;
-	uintmax_t i;
+	int ret = SEEKGZIP_SUCCESS, version, utime;
+	uint32_t features = 0;
+	uintmax_t i, n;
+	uint32_t fingerprint = 0, check;
+	struct point *p;
+	off_t size = 0;
 	gzFile gz;
 	
 	if( (ret = seekgzip_index_alloc(sz)) != SEEKGZIP_SUCCESS)
 		return ret;
-	
-	// Check index mod time
-	switch( (ret = seekgzip_index_checkutime(sz)) ){
-		case 0: // match
-			break;
-		case 1: // not match
-			return SEEKGZIP_EXPIREDINDEX;
-		default:
-			return SEEKGZIP_OPENERROR;
-	}
+	if (sz->path_index == NULL)
+		return SEEKGZIP_OPENERROR;
 
 	// Open the index file for reading.
-	gz = gzopen(sz->path_index, "rb");
+	if (seekgzip_is_url(sz->path_index)) {
+		seekgzip_source_t *src = seekgzip_source_http(sz->path_index);
+		gz = src != NULL ? open_remote_index(src) : NULL;
+		if (src != NULL)
+			src->close(src);
+	} else {
+		gz = gzopen(sz->path_index, "rb");
+	}
 	if (gz == NULL)
 		return SEEKGZIP_OPENERROR;
 
 	// Read the magic string.
-	if (gzgetc(gz) != 'Z' || gzgetc(gz) != 'S' || gzgetc(gz) != 'E' || gzgetc(gz) != '2'){
+	if (gzgetc(gz) != 'Z' || gzgetc(gz) != 'S' || gzgetc(gz) != 'E'){
+		ret = SEEKGZIP_IMCOMPATIBLE;
+		goto error_exit;
+	}
+	version = gzgetc(gz) - '0';
+	if (version < 2 || 4 < version) {
 		ret = SEEKGZIP_IMCOMPATIBLE;
 		goto error_exit;
 	}
@@ -564,67 +3536,593 @@ int seekgzip_index_load(seekgzip_t *sz){
 		goto error_exit;
 	}
 
-	// Read the number of entry points.
-	sz->index->nelements = sz->index->allocated = read_uint32(gz);
-	if(__MAX(uintmax_t) / sizeof(struct point) <= sz->index->nelements){
+	// Check for optional sections we do not understand.
+	if (3 <= version)
+		features = read_uint32(gz);
+	if (features & ~INDEX_FEATURES) {
 		ret = SEEKGZIP_IMCOMPATIBLE;
 		goto error_exit;
 	}
+	sz->index->crc = (features & INDEX_CRC) != 0;
+	sz->index->members = (features & INDEX_MEMBERS) != 0;
 
-	// Allocate an array for entry points.
-	sz->index->list = (struct point*)malloc(sizeof(struct point) * sz->index->nelements);
-	if (sz->index->list == NULL) {
-		ret = SEEKGZIP_OUTOFMEMORY;
+	// Verified reads need span CRCs; rebuild an index without them.
+	if ((sz->flags & SEEKGZIP_VERIFY) && !sz->index->crc) {
+		ret = SEEKGZIP_IMCOMPATIBLE;
 		goto error_exit;
 	}
-	
+
+	// Read the number of entry points.
+	n = version == 4 ? read_uint64(gz) : read_uint32(gz);
+	if(n == 0 || SIZE_MAX / (sizeof(struct point) + sizeof(off_t)) <= n){
+		ret = SEEKGZIP_IMCOMPATIBLE;
+		goto error_exit;
+	}
+
 	// Read size of unpacked file
 	gzread(gz, &sz->totin,  sizeof(off_t));
 	gzread(gz, &sz->totout, sizeof(off_t));
+
+	// Check index mod time, and the size of the compressed data.
+	utime = seekgzip_index_checkutime(sz);
+	if (3 <= version) {
+		gzread(gz, &size, sizeof(off_t));
+		fingerprint = read_uint32(gz);
+		if (size != sz->src->size(sz->src)) {
+			ret = SEEKGZIP_EXPIREDINDEX;
+			goto error_exit;
+		}
+	} else if (utime != 0) {
+		ret = utime == 1 ? SEEKGZIP_EXPIREDINDEX : SEEKGZIP_OPENERROR;
+		goto error_exit;
+	}
+
+	// Allocate an array for entry points.
+	if (access_resize(sz->index, n) != 0) {
+		ret = SEEKGZIP_OUTOFMEMORY;
+		goto error_exit;
+	}
 	
-	// Read entry points.
-	for (i = 0; i < sz->index->nelements; ++i) {
-		gzread(gz, &sz->index->list[i].out, sizeof(off_t));
-		gzread(gz, &sz->index->list[i].in, sizeof(off_t));
-		gzread(gz, &sz->index->list[i].bits, sizeof(int));
-		gzread(gz, sz->index->list[i].window, WINSIZE);
+	// Read entry points; windows are read straight into their blocks.
+	for (i = 0; i < n; ++i) {
+		p = &sz->index->list[i];
+		gzread(gz, &p->out, sizeof(off_t));
+		gzread(gz, &p->in, sizeof(off_t));
+		gzread(gz, &p->bits, sizeof(int));
+		p->crc = sz->index->crc ? read_uint32(gz) : 0;
+		p->window = NULL;
+		if (p->bits != MEMBER_START) {
+			if( (p->window = window_alloc(sz->index)) == NULL){
+				ret = SEEKGZIP_OUTOFMEMORY;
+				goto error_exit;
+			}
+			if (gzread(gz, p->window, WINSIZE) != WINSIZE) {
+				ret = SEEKGZIP_IMCOMPATIBLE;
+				goto error_exit;
+			}
+		}
+		sz->index->out[i] = p->out;
+		sz->index->nelements = i + 1;
+	}
+
+	// Read tar members.
+	if ((features & INDEX_TAR) && (ret = load_tar(gz, sz->index)) != SEEKGZIP_SUCCESS)
+		goto error_exit;
+
+	// Compare fingerprints unless the modification time vouches for the file.
+	if (3 <= version && (utime != 0 || (sz->flags & SEEKGZIP_STRICT))) {
+		if( (ret = index_fingerprint(sz, &check)) != SEEKGZIP_SUCCESS)
+			goto error_exit;
+		if (check != fingerprint) {
+			ret = SEEKGZIP_EXPIREDINDEX;
+			goto error_exit;
+		}
+		if (utime != 0)
+			seekgzip_index_setutime(sz);
 	}
 
 error_exit:
-	// Close the index filiiiie.
-	if (gzclose(gz) != 0) {
+	// Close the index file.
+	if (gzclose(gz) != 0 && ret == SEEKGZIP_SUCCESS)
 		ret = SEEKGZIP_ZLIBERROR;
+	return ret;
+}
+
+/* Read the lengths recorded in the index of target without loading the
+   windows.  As in seekgzip_index_load(), an index whose modification time
+   differs from the data is trusted if the size and the fingerprint match,
+   and is stamped again; for the fingerprint only the offsets of the access
+   points are read. */
+int seekgzip_peek(const char *target, off_t *unpacked, off_t *packed)
+{
+	int ret = SEEKGZIP_SUCCESS, version, utime, k = 0;
+	uint32_t features = 0, fingerprint, check;
+	uintmax_t i, n;
+	off_t size = 0, in[FINGERPRINT_POINTS];
+	struct point p;
+	gzFile gz = NULL;
+	seekgzip_t sz;
+
+	memset(&sz, 0, sizeof(sz));
+	if( (sz.path_index = get_index_file(target)) == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+	if (seekgzip_is_url(target) || seekgzip_is_url(sz.path_index)) {
+		ret = SEEKGZIP_EXPIREDINDEX;
+		goto error_exit;
+	}
+	if( (sz.src = seekgzip_source_file(target)) == NULL){
+		ret = SEEKGZIP_OPENERROR;
+		goto error_exit;
+	}
+	utime = seekgzip_index_checkutime(&sz);
+	if( (gz = gzopen(sz.path_index, "rb")) == NULL){
+		ret = SEEKGZIP_OPENERROR;
+		goto error_exit;
+	}
+
+	if (gzgetc(gz) != 'Z' || gzgetc(gz) != 'S' || gzgetc(gz) != 'E' ||
+		(version = gzgetc(gz) - '0') < 2 || 4 < version ||
+		read_uint32(gz) != sizeof(off_t)) {
+		ret = SEEKGZIP_IMCOMPATIBLE;
+		goto error_exit;
+	}
+	if (3 <= version && ((features = read_uint32(gz)) & ~INDEX_FEATURES) != 0) {
+		ret = SEEKGZIP_IMCOMPATIBLE;
+		goto error_exit;
+	}
+	n = version == 4 ? read_uint64(gz) : read_uint32(gz);
+	gzread(gz, packed, sizeof(off_t));
+	if (gzread(gz, unpacked, sizeof(off_t)) != sizeof(off_t)) {
+		ret = SEEKGZIP_IMCOMPATIBLE;
+		goto error_exit;
+	}
+	if (utime == 0)
+		goto error_exit;
+	if (version < 3) {
+		ret = SEEKGZIP_EXPIREDINDEX;
+		goto error_exit;
+	}
+	if (gzread(gz, &size, sizeof(off_t)) != sizeof(off_t) ||
+		size != sz.src->size(sz.src)) {
+		ret = SEEKGZIP_EXPIREDINDEX;
+		goto error_exit;
+	}
+	fingerprint = read_uint32(gz);
+
+	// Collect the offsets of the sampled points, skipping the windows.
+	for (i = 0;i < n && k < FINGERPRINT_POINTS;++i) {
+		gzread(gz, &p.out, sizeof(off_t));
+		gzread(gz, &p.in, sizeof(off_t));
+		if (gzread(gz, &p.bits, sizeof(int)) != sizeof(int)) {
+			ret = SEEKGZIP_IMCOMPATIBLE;
+			goto error_exit;
+		}
+		if (features & INDEX_CRC)
+			read_uint32(gz);
+		if (p.bits != MEMBER_START && gzseek(gz, WINSIZE, SEEK_CUR) == -1) {
+			ret = SEEKGZIP_IMCOMPATIBLE;
+			goto error_exit;
+		}
+		while (k < FINGERPRINT_POINTS && (uintmax_t)k < n && fingerprint_point(k, n) == i)
+			in[k++] = p.in;
+	}
+	if( (ret = source_fingerprint(sz.src, in, k, &check)) != SEEKGZIP_SUCCESS)
+		goto error_exit;
+	if (check != fingerprint) {
+		ret = SEEKGZIP_EXPIREDINDEX;
 		goto error_exit;
 	}
+	seekgzip_index_setutime(&sz);
+
+error_exit:
+	if (gz != NULL)
+		gzclose(gz);
+	if (sz.src != NULL)
+		sz.src->close(sz.src);
+	free(sz.path_index);
+	return ret;
+}
+
+/*===== Foreign indexes ===== {{{*/
+
+/* Indexes written by other tools are converted to access points without
+   decoding the file:
+
+   - bgzip (.gzi): a little-endian count followed by (compressed, uncompressed)
+     offset pairs of BGZF block starts, except the first block.  Every block
+     is a gzip member, so the entries become MEMBER_START points; only
+     entries about SPAN bytes apart are kept.
+   - indexed_gzip (GZIDX, version 1): a header with the sizes, spacing,
+     window size and number of points, the points as (compressed offset,
+     uncompressed offset, bits, has-window), then the windows.  The points
+     match ours.
+
+   Neither carries span CRCs. */
+
+static uint64_t get_uint64(const unsigned char *p)
+{
+	return (uint64_t)get_uint32(p) | (uint64_t)get_uint32(p + 4) << 32;
+}
+
+static void put_uint64(unsigned char *p, uint64_t v)
+{
+	put_uint32(p, (uint32_t)v);
+	put_uint32(p + 4, (uint32_t)(v >> 32));
+}
+
+/* The offset of the deflate data of the gzip member at in, or -1. */
+static off_t member_data(seekgzip_source_t *src, off_t in)
+{
+	int i;
+	ssize_t got;
+	unsigned char h[256];
+	off_t pos = in + 10;
+
+	if (src->read_at(src, h, 10, in) != 10 || h[0] != 0x1f || h[1] != 0x8b || h[2] != Z_DEFLATED)
+		return -1;
+	if (h[3] & 4) {				/* FEXTRA */
+		if (src->read_at(src, h + 10, 2, pos) != 2)
+			return -1;
+		pos += 2 + (h[10] | h[11] << 8);
+	}
+	for (i = 8;i <= 16;i <<= 1) {		/* FNAME, FCOMMENT */
+		if (!(h[3] & i))
+			continue;
+		for (;;) {
+			if( (got = src->read_at(src, h, sizeof(h), pos)) <= 0)
+				return -1;
+			if (memchr(h, 0, got) != NULL) {
+				pos += (unsigned char*)memchr(h, 0, got) - h + 1;
+				break;
+			}
+			pos += got;
+		}
+	}
+	if (h[3] & 2)				/* FHCRC */
+		pos += 2;
+	return pos;
+}
+
+/* The uncompressed offset of the end of the stream, decoding from here. */
+static off_t stream_end(seekgzip_source_t *src, struct point *here)
+{
+	int ret;
+	off_t end;
+	struct access one;
+	struct cursor c;
+	unsigned char *buffer;
+
+	memset(&one, 0, sizeof(one));
+	one.nelements = one.allocated = 1;
+	one.list = here;
+	one.out = &here->out;
+	if( (buffer = (unsigned char*)malloc(SPAN)) == NULL)
+		return -1;
+	if (cursor_open(&c, src, &one, here->out) != Z_OK) {
+		free(buffer);
+		return -1;
+	}
+	while ((ret = cursor_read(&c, buffer, SPAN)) > 0)
+		;
+	end = ret == 0 ? c.out : -1;
+	cursor_close(&c);
+	free(buffer);
+	return end;
+}
+
+static int import_gzi(seekgzip_t *sz, FILE *fp)
+{
+	uint64_t i, n;
+	unsigned char b[16];
+	struct point *p, last;
+	struct access *index = sz->index;
+	off_t size = sz->src->size(sz->src);
+
+	if (fread(b, 1, 8, fp) != 8)
+		return SEEKGZIP_IMCOMPATIBLE;
+	n = get_uint64(b);
+
+	/* the first block is implicit */
+	memset(&last, 0, sizeof(last));
+	last.bits = MEMBER_START;
+	if( (index = addpoint(index, MEMBER_START, 0, 0, 0, NULL)) == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+	for (i = 0;i < n;++i) {
+		if (fread(b, 1, 16, fp) != 16)
+			return SEEKGZIP_IMCOMPATIBLE;
+		p = &index->list[index->nelements - 1];
+		if ((off_t)get_uint64(b) <= last.in || size <= (off_t)get_uint64(b) ||
+			(off_t)get_uint64(b + 8) < last.out)
+			return SEEKGZIP_IMCOMPATIBLE;
+		last.in = (off_t)get_uint64(b);
+		last.out = (off_t)get_uint64(b + 8);
+		if (SPAN < last.out - p->out &&
+			addpoint(index, MEMBER_START, last.in, last.out, 0, NULL) == NULL)
+			return SEEKGZIP_OUTOFMEMORY;
+	}
+
+	index->members = 1;
+	sz->totin = size;
+	sz->totout = stream_end(sz->src, &last);
+	return sz->totout < 0 ? SEEKGZIP_DATAERROR : SEEKGZIP_SUCCESS;
+}
+
+static int import_gzidx(seekgzip_t *sz, FILE *fp)
+{
+	uint32_t i, n;
+	unsigned char b[34], *flags;
+	struct point *p;
+	struct access *index = sz->index;
+	off_t size = sz->src->size(sz->src);
+	int ret = SEEKGZIP_SUCCESS;
+
+	/* the magic "GZIDX" has been read */
+	if (fread(b, 1, 30, fp) != 30 || b[0] != 1)
+		return SEEKGZIP_IMCOMPATIBLE;
+	if (get_uint32(b + 22) != WINSIZE || (off_t)get_uint64(b + 2) != size)
+		return SEEKGZIP_IMCOMPATIBLE;
+	n = get_uint32(b + 26);
+	if (n == 0)
+		return SEEKGZIP_IMCOMPATIBLE;
+	sz->totin = size;
+	sz->totout = (off_t)get_uint64(b + 10);
+
+	if (access_resize(index, n) != 0 || window_reserve(index, n) != 0 ||
+		(flags = (unsigned char*)malloc(n)) == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+	for (i = 0;i < n;++i) {
+		p = &index->list[i];
+		if (fread(b, 1, 18, fp) != 18 || 7 < b[16]) {
+			ret = SEEKGZIP_IMCOMPATIBLE;
+			goto error_exit;
+		}
+		p->in = (off_t)get_uint64(b);
+		p->out = (off_t)get_uint64(b + 8);
+		p->bits = b[16];
+		p->crc = 0;
+		p->window = window_alloc(index);
+		index->out[i] = p->out;
+		flags[i] = b[17];
+		if (size < p->in || (i && p->out < p[-1].out)) {
+			ret = SEEKGZIP_IMCOMPATIBLE;
+			goto error_exit;
+		}
+		index->nelements = i + 1;
+	}
+	for (i = 0;i < n;++i) {
+		p = &index->list[i];
+		if (!flags[i]) {
+			memset(p->window, 0, WINSIZE);
+		} else if (fread(p->window, 1, WINSIZE, fp) != WINSIZE) {
+			ret = SEEKGZIP_IMCOMPATIBLE;
+			goto error_exit;
+		}
+	}
+
+	/* an index built on demand may stop short of the end */
+	if (sz->totout < index->list[n - 1].out) {
+		ret = SEEKGZIP_IMCOMPATIBLE;
+	} else if (sz->totout == 0 || index->list[n - 1].out == sz->totout) {
+		if( (sz->totout = stream_end(sz->src, &index->list[n - 1])) < 0)
+			ret = SEEKGZIP_DATAERROR;
+	}
+
+error_exit:
+	free(flags);
+	return ret;
+}
+
+static int index_import(seekgzip_t *sz, const char *path)
+{
+	int ret;
+	unsigned char magic[5];
+	FILE *fp;
+
+	if (sz->src == NULL)
+		return SEEKGZIP_ERROR;
+	if( (ret = seekgzip_index_alloc(sz)) != SEEKGZIP_SUCCESS)
+		return ret;
+	if( (fp = fopen(path, "rb")) == NULL)
+		return SEEKGZIP_OPENERROR;
+
+	// Tell the formats apart by the magic of GZIDX.
+	if (fread(magic, 1, 5, fp) == 5 && memcmp(magic, "GZIDX", 5) == 0) {
+		ret = import_gzidx(sz, fp);
+	} else {
+		rewind(fp);
+		ret = import_gzi(sz, fp);
+	}
+	fclose(fp);
+
+	if (ret != SEEKGZIP_SUCCESS)
+		seekgzip_index_free(sz);
+	return ret;
+}
+
+int seekgzip_import(const char *target, const char *path)
+{
+	int ret;
+	seekgzip_t sz;
+
+	memset(&sz, 0, sizeof(sz));
+	if( (sz.path_index = get_index_file(target)) == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+	if (seekgzip_is_url(target))
+		sz.src = seekgzip_source_http(target);
+	else
+		sz.src = seekgzip_source_file(target);
+
+	if (sz.src == NULL)
+		ret = SEEKGZIP_OPENERROR;
+	else if( (ret = index_import(&sz, path)) == SEEKGZIP_SUCCESS)
+		ret = seekgzip_index_save(&sz);
+
+	seekgzip_index_free(&sz);
+	if (sz.src != NULL)
+		sz.src->close(sz.src);
+	free(sz.path_index);
+	return ret;
+}
+
+static int export_gzi(seekgzip_t *sz, FILE *fp)
+{
+	uintmax_t i;
+	unsigned char b[16];
+	struct access *index = sz->index;
+
+	// Only member starts can be listed, and the first one is implicit.
+	for (i = 0;i < index->nelements;++i) {
+		if (index->list[i].bits != MEMBER_START)
+			return SEEKGZIP_IMCOMPATIBLE;
+	}
+	put_uint64(b, index->nelements - 1);
+	if (fwrite(b, 1, 8, fp) != 8)
+		return SEEKGZIP_WRITEERROR;
+	for (i = 1;i < index->nelements;++i) {
+		put_uint64(b, (uint64_t)index->list[i].in);
+		put_uint64(b + 8, (uint64_t)index->list[i].out);
+		if (fwrite(b, 1, 16, fp) != 16)
+			return SEEKGZIP_WRITEERROR;
+	}
+	return SEEKGZIP_SUCCESS;
+}
+
+static int export_gzidx(seekgzip_t *sz, FILE *fp)
+{
+	uintmax_t i;
+	off_t in;
+	unsigned char b[35];
+	struct access *index = sz->index;
+	static const unsigned char zeros[WINSIZE];
+
+	memcpy(b, "GZIDX", 5);
+	b[5] = 1;				/* version */
+	b[6] = 0;				/* flags */
+	put_uint64(b + 7, (uint64_t)sz->totin);
+	put_uint64(b + 15, (uint64_t)sz->totout);
+	put_uint32(b + 23, SPAN);
+	put_uint32(b + 27, WINSIZE);
+	put_uint32(b + 31, (uint32_t)index->nelements);
+	if (index->nelements >> 32 || fwrite(b, 1, 35, fp) != 35)
+		return SEEKGZIP_WRITEERROR;
+
+	// A member start becomes a point at its deflate data with an empty window.
+	for (i = 0;i < index->nelements;++i) {
+		in = index->list[i].in;
+		if (index->list[i].bits == MEMBER_START && (in = member_data(sz->src, in)) < 0)
+			return SEEKGZIP_DATAERROR;
+		put_uint64(b, (uint64_t)in);
+		put_uint64(b + 8, (uint64_t)index->list[i].out);
+		b[16] = index->list[i].bits == MEMBER_START ? 0 : index->list[i].bits;
+		b[17] = 1;
+		if (fwrite(b, 1, 18, fp) != 18)
+			return SEEKGZIP_WRITEERROR;
+	}
+	for (i = 0;i < index->nelements;++i) {
+		if (fwrite(index->list[i].bits == MEMBER_START ? zeros : index->list[i].window,
+			1, WINSIZE, fp) != WINSIZE)
+			return SEEKGZIP_WRITEERROR;
+	}
+	return SEEKGZIP_SUCCESS;
+}
+
+int seekgzip_index_export(seekgzip_t *sz, const char *path, int format)
+{
+	int ret;
+	FILE *fp;
+
+	if (sz->index == NULL)
+		return SEEKGZIP_ERROR;
+	if( (fp = fopen(path, "wb")) == NULL)
+		return SEEKGZIP_OPENERROR;
+	if (format == SEEKGZIP_FORMAT_GZI)
+		ret = export_gzi(sz, fp);
+	else if (format == SEEKGZIP_FORMAT_GZIDX)
+		ret = export_gzidx(sz, fp);
+	else
+		ret = SEEKGZIP_ERROR;
+	if (fclose(fp) != 0 && ret == SEEKGZIP_SUCCESS)
+		ret = SEEKGZIP_WRITEERROR;
+	if (ret != SEEKGZIP_SUCCESS)
+		remove(path);
+	return ret;
+}
+
+/* Look for a foreign index next to the file when it has no index of ours. */
+static int import_beside(seekgzip_t *sz)
+{
+	static const char *suffixes[] = {".gzi", ".gzidx", NULL};
+	int i, ret = SEEKGZIP_OPENERROR;
+	size_t len;
+	char *path;
+
+	if (sz->path_index == NULL || seekgzip_is_url(sz->path_index))
+		return SEEKGZIP_OPENERROR;
+	len = strlen(sz->path_index);
+	if (len < 4 || strcmp(sz->path_index + len - 4, ".idx") != 0)
+		return SEEKGZIP_OPENERROR;
+	if( (path = (char*)malloc(len + 3)) == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+
+	for (i = 0;suffixes[i] != NULL && ret != SEEKGZIP_SUCCESS;++i) {
+		memcpy(path, sz->path_index, len - 4);
+		strcpy(path + len - 4, suffixes[i]);
+		if (access(path, R_OK) == 0)
+			ret = index_import(sz, path);
+	}
+	free(path);
 	return ret;
 }
 
+/*===== End of foreign indexes ===== }}}*/
+
 seekgzip_t* seekgzip_open(const char *target, int flags)
+{
+	char *index;
+	seekgzip_t *sz;
+	seekgzip_source_t *src;
+
+	// Prepare the name for the index file.
+	if( (index = get_index_file(target)) == NULL)
+		return NULL;
+
+	// Open the target gzip file for reading.
+	if (seekgzip_is_url(target))
+		src = seekgzip_source_http(target);
+	else
+		src = seekgzip_source_file(target);
+
+	sz = seekgzip_open_source(src, index, flags);
+	free(index);
+	return sz;
+}
+
+seekgzip_t* seekgzip_open_source(seekgzip_source_t *src, const char *index, int flags)
 {
 	seekgzip_t *sz;
 	
-	if( (sz = (seekgzip_t *)malloc(sizeof(seekgzip_t))) == NULL)
+	if( (sz = (seekgzip_t *)malloc(sizeof(seekgzip_t))) == NULL){
+		if (src != NULL)
+			src->close(src);
 		return NULL;
+	}
 	
 	sz->offset = 0;
 	sz->errorcode = 0;
+	sz->flags = flags;
 	sz->index = NULL;
+	sz->path_index = NULL;
+	sz->readahead = NULL;
+	sz->cache = NULL;
+	sz->hot = NULL;
+	sz->src = src;
 
-	// Open the target gzip file for reading.
-	sz->fp = fopen(target, "rb");
-	if (sz->fp == NULL) {
+	if (sz->src == NULL) {
 		sz->errorcode = SEEKGZIP_OPENERROR;
 		goto error_exit;
 	}
-	
-	if( (sz->path_data = strdup(target)) == NULL){
-		sz->errorcode = SEEKGZIP_OUTOFMEMORY;
-		goto error_exit;
-	}
 
-	// Prepare the name for the index file.
-	sz->path_index = get_index_file(target);
-	if (sz->path_index == NULL) {
+	if (index != NULL && (sz->path_index = strdup(index)) == NULL) {
 		sz->errorcode = SEEKGZIP_OUTOFMEMORY;
 		goto error_exit;
 	}
@@ -637,8 +4135,14 @@ seekgzip_t* seekgzip_open(const char *target, int flags)
 		case SEEKGZIP_OPENERROR:
 		case SEEKGZIP_IMCOMPATIBLE:
 		case SEEKGZIP_EXPIREDINDEX:
-			// build index and save it
+			// import an index of another tool, or build index, and save it
 
+			if (sz->errorcode == SEEKGZIP_OPENERROR && !(flags & SEEKGZIP_VERIFY) &&
+				import_beside(sz) == SEEKGZIP_SUCCESS) {
+				sz->errorcode = SEEKGZIP_SUCCESS;
+				seekgzip_index_save(sz);
+				break;
+			}
 			sz->errorcode = seekgzip_index_build(sz);
 			if( sz->errorcode == SEEKGZIP_SUCCESS ){
 				seekgzip_index_save(sz); // return value is not important, maybe we cannot write to file, so
@@ -650,6 +4154,11 @@ seekgzip_t* seekgzip_open(const char *target, int flags)
 			goto error_exit;
 	}
 
+	if (sz->errorcode == SEEKGZIP_SUCCESS && (flags & SEEKGZIP_READAHEAD))
+		sz->errorcode = seekgzip_readahead(sz, READAHEAD_DEPTH, 0);
+	if (sz->errorcode == SEEKGZIP_SUCCESS && (flags & (SEEKGZIP_CHECKPOINTS | SEEKGZIP_SAVE_CHECKPOINTS)))
+		sz->errorcode = seekgzip_checkpoints(sz, CHECKPOINT_STEP, CHECKPOINT_LIMIT);
+
 error_exit:
 	return sz;
 }
@@ -659,19 +4168,24 @@ void seekgzip_close(seekgzip_t* sz)
 	if (sz == NULL)
 		return;
 	
+	readahead_free(sz);
+	cache_free(sz);
+
+	// Write checkpoints back to the index file if asked to.
+	if (sz->hot != NULL && sz->hot->dirty && (sz->flags & SEEKGZIP_SAVE_CHECKPOINTS) &&
+		hot_merge(sz) == SEEKGZIP_SUCCESS) {
+		seekgzip_index_save(sz);
+	}
+	hot_free(sz);
 	seekgzip_index_free(sz);
-	if (sz->fp != NULL){
-		fclose(sz->fp);
-		sz->fp = NULL;
+	if (sz->src != NULL){
+		sz->src->close(sz->src);
+		sz->src = NULL;
 	}
 	if (sz->path_index != NULL){
 		free(sz->path_index);
 		sz->path_index = NULL;
 	}
-	if (sz->path_data != NULL){
-		free(sz->path_data);
-		sz->path_data = NULL;
-	}
 	free(sz);
 }
 
@@ -697,13 +4211,29 @@ off_t seekgzip_packed_length(seekgzip_t *sz)
 
 int seekgzip_read(seekgzip_t* sz, void *buffer, int size)
 {
-	int len = extract(sz->fp, sz->index, sz->offset, (unsigned char*)buffer, size);
+	int len;
+
+	if (sz->readahead != NULL)
+		len = readahead_read(sz, (unsigned char*)buffer, size);
+	else
+		len = seekgzip_pread(sz, buffer, size, sz->offset);
 	if (0 < len) {
 		sz->offset += len;
 	}
 	return len;
 }
 
+int seekgzip_pread(seekgzip_t* sz, void *buffer, int size, off_t offset)
+{
+	if (sz->cache != NULL)
+		return cache_read(sz, (unsigned char*)buffer, size, offset);
+	if (sz->flags & SEEKGZIP_VERIFY)
+		return verify_read(sz, (unsigned char*)buffer, size, offset);
+	if (sz->hot != NULL)
+		return hot_read(sz, (unsigned char*)buffer, size, offset);
+	return extract(sz->src, sz->index, offset, (unsigned char*)buffer, size);
+}
+
 int seekgzip_error(seekgzip_t* sz)
 {
 	if(sz == NULL)
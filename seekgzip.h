@@ -1,7 +1,21 @@
 #ifndef __SEEKGZIP_H__
 #define __SEEKGZIP_H__
 
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+
 struct tag_seekgzip; typedef struct tag_seekgzip seekgzip_t;
+struct tag_seekgzip_source; typedef struct tag_seekgzip_source seekgzip_source_t;
+
+/* Positioned reads of the compressed data; read_at() must be safe to call
+   from several threads at once.  mtime() returns (time_t)-1 if unknown. */
+struct tag_seekgzip_source {
+	ssize_t (*read_at)(seekgzip_source_t *src, void *buffer, size_t size, off_t offset);
+	off_t (*size)(seekgzip_source_t *src);
+	time_t (*mtime)(seekgzip_source_t *src);
+	void (*close)(seekgzip_source_t *src);
+};
 
 enum {
 	SEEKGZIP_SUCCESS=0,
@@ -14,6 +28,16 @@ enum {
 	SEEKGZIP_OUTOFMEMORY,
 	SEEKGZIP_IMCOMPATIBLE,
 	SEEKGZIP_ZLIBERROR,
+	SEEKGZIP_BUSY,
+};
+
+/* Flags for seekgzip_open(). */
+enum {
+	SEEKGZIP_READAHEAD=0x0001,	/* decode ahead of sequential reads */
+	SEEKGZIP_STRICT=0x0002,		/* always check the index fingerprint */
+	SEEKGZIP_VERIFY=0x0004,		/* check span CRCs while reading */
+	SEEKGZIP_CHECKPOINTS=0x0008,	/* add access points inside hot spans */
+	SEEKGZIP_SAVE_CHECKPOINTS=0x0010,	/* ...and save them with the index */
 };
 
 seekgzip_t*
@@ -22,6 +46,19 @@ seekgzip_open(
 	int flags
 	);
 
+/* Open a handle on an arbitrary source, which the handle then owns.  The
+   index is read from (and saved to) the path index, which may be NULL. */
+seekgzip_t*
+seekgzip_open_source(
+	seekgzip_source_t *src,
+	const char *index,
+	int flags
+	);
+
+seekgzip_source_t* seekgzip_source_file(const char *path);
+seekgzip_source_t* seekgzip_source_http(const char *url);
+int seekgzip_is_url(const char *target);
+
 void
 seekgzip_close(
 	seekgzip_t* zs
@@ -45,13 +82,270 @@ seekgzip_read(
 	int size
 	);
 
+/* Read at offset without moving the file pointer; safe to call from
+   several threads on the same handle. */
+int
+seekgzip_pread(
+	seekgzip_t* sz,
+	void *buffer,
+	int size,
+	off_t offset
+	);
+
 int
 seekgzip_error(
 	seekgzip_t* sgz
 	);
 
+int
+seekgzip_readahead(
+	seekgzip_t* sz,
+	int depth,
+	size_t limit
+	);
+
+int
+seekgzip_cache(
+	seekgzip_t* sz,
+	size_t limit
+	);
+
+/* Add access points every step bytes inside spans that are read often,
+   using at most limit bytes for them; a limit of zero disables this.
+   Verified reads use them too.  With a span cache they are not used, since
+   a cache miss decodes the whole span anyway. */
+int
+seekgzip_checkpoints(
+	seekgzip_t* sz,
+	off_t step,
+	size_t limit
+	);
+
+/* Decode the whole file on nthreads threads, checking the CRC of every span
+   and of the whole stream against the gzip trailer.  The callback, if any,
+   is called for each corrupted range (the whole stream for a trailer
+   mismatch) with the error code.  An index without span CRCs, such as an
+   imported one, gets the computed CRCs saved once the stream checks out. */
+typedef void (*seekgzip_verify_callback)(void *instance, off_t begin, off_t end, int error);
+
+int
+seekgzip_verify(
+	seekgzip_t* sz,
+	int nthreads,
+	seekgzip_verify_callback callback,
+	void *instance
+	);
+
+/* Derive an index with access points about every span bytes from the
+   current one, decoding spans on nthreads threads, and save it.  No other
+   thread may use the handle meanwhile. */
+int
+seekgzip_reindex(
+	seekgzip_t* sz,
+	off_t span,
+	int nthreads
+	);
+
+/* Write the data of sz to output as one gzip member per span (BGZF blocks
+   with bgzf), compressing on nthreads threads, and save an index of the
+   output whose access points need no windows. */
+int
+seekgzip_repack(
+	seekgzip_t* sz,
+	const char *output,
+	int nthreads,
+	int bgzf
+	);
+
+/* Draw k uniformly distributed offsets (seeded by seed) and report the
+   records, terminated by delim, that contain them, in file order and each
+   record once; so at most k records are reported, fewer when offsets fall
+   in the same record.  Longer records are proportionally more likely to be
+   drawn. */
+typedef void (*seekgzip_sample_callback)(void *instance, off_t offset, const void *record, size_t size);
+
+int
+seekgzip_sample(
+	seekgzip_t* sz,
+	int k,
+	unsigned long seed,
+	int delim,
+	int nthreads,
+	seekgzip_sample_callback callback,
+	void *instance
+	);
+
+/* Formats of indexes of other tools. */
+enum {
+	SEEKGZIP_FORMAT_GZI=1,		/* bgzip (htslib) block index */
+	SEEKGZIP_FORMAT_GZIDX=2,	/* indexed_gzip export, version 1 */
+};
+
+/* Convert the .gzi or GZIDX index at path into the index of target. */
+int
+seekgzip_import(
+	const char *target,
+	const char *path
+	);
+
+/* Write the index of sz to path in one of the formats above. */
+int
+seekgzip_index_export(
+	seekgzip_t* sz,
+	const char *path,
+	int format
+	);
+
+/* Lengths of a file from its index header, if the index is up to date,
+   checked as seekgzip_open() would. */
+int
+seekgzip_peek(
+	const char *filename,
+	off_t *unpacked,
+	off_t *packed
+	);
+
 off_t seekgzip_unpacked_length(seekgzip_t *sz);
 off_t seekgzip_packed_length(seekgzip_t *sz);
 
+/* An ordered list of gzip files read as one uncompressed stream. */
+struct tag_seekgzip_set; typedef struct tag_seekgzip_set seekgzip_set_t;
+
+seekgzip_set_t*
+seekgzip_set_open(
+	const char **filenames,
+	int n,
+	int maxopen,
+	int flags
+	);
+
+void
+seekgzip_set_close(
+	seekgzip_set_t* zset
+	);
+
+void
+seekgzip_set_seek(
+	seekgzip_set_t *zset,
+	off_t offset
+	);
+
+off_t
+seekgzip_set_tell(
+	seekgzip_set_t *zset
+	);
+
+int
+seekgzip_set_read(
+	seekgzip_set_t* zset,
+	void *buffer,
+	int size
+	);
+
+int
+seekgzip_set_error(
+	seekgzip_set_t* zset
+	);
+
+off_t seekgzip_set_unpacked_length(seekgzip_set_t *zset);
+
+/* Map a global offset to the file that holds it and the offset within. */
+int
+seekgzip_set_locate(
+	seekgzip_set_t *zset,
+	off_t offset,
+	off_t *local
+	);
+
+/* Members of a tar archive, recorded when the index of a .tar.gz file was
+   built; the data of member i is at [offset, offset + size). */
+intmax_t seekgzip_tar_count(seekgzip_t *sz);
+
+int
+seekgzip_tar_member(
+	seekgzip_t *sz,
+	intmax_t i,
+	const char **name,
+	off_t *offset,
+	off_t *size,
+	int *type
+	);
+
+/* The last member named name (a leading "./" is ignored), or -1. */
+intmax_t
+seekgzip_tar_find(
+	seekgzip_t *sz,
+	const char *name
+	);
+
+/* Pass the data of member i to callback in order, decoding it once from the
+   access point before it; returns SEEKGZIP_SUCCESS or an error code. */
+typedef void (*seekgzip_tar_callback)(void *instance, const void *data, size_t size);
+
+int
+seekgzip_tar_read(
+	seekgzip_t *sz,
+	intmax_t i,
+	seekgzip_tar_callback callback,
+	void *instance
+	);
+
+/* Reads served by a pool of worker threads for event loops; see
+   seekgzip_async.c.  The callback gets the buffer and the return value of
+   seekgzip_pread() for it. */
+struct tag_seekgzip_async; typedef struct tag_seekgzip_async seekgzip_async_t;
+typedef void (*seekgzip_async_callback)(void *instance, void *buffer, int result);
+
+seekgzip_async_t*
+seekgzip_async_open(
+	seekgzip_t *sz,
+	int nthreads,
+	int depth
+	);
+
+void
+seekgzip_async_close(
+	seekgzip_async_t *aq
+	);
+
+/* Queue a read of size bytes at offset; SEEKGZIP_BUSY if depth requests
+   are already in flight. */
+int
+seekgzip_async_submit(
+	seekgzip_async_t *aq,
+	void *buffer,
+	int size,
+	off_t offset,
+	seekgzip_async_callback callback,
+	void *instance
+	);
+
+/* A descriptor that becomes readable when requests have completed. */
+int
+seekgzip_async_fd(
+	seekgzip_async_t *aq
+	);
+
+/* Run the callbacks of up to max (all if max <= 0) completed requests
+   without blocking; returns how many were run. */
+int
+seekgzip_async_poll(
+	seekgzip_async_t *aq,
+	int max
+	);
+
+/* Like seekgzip_async_poll(), but wait for a completion first if any
+   request is in flight. */
+int
+seekgzip_async_wait(
+	seekgzip_async_t *aq,
+	int max
+	);
+
+int
+seekgzip_async_error(
+	seekgzip_async_t *aq
+	);
+
 #endif/*__SEEKGZIP_H__*/
 
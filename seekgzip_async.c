@@ -0,0 +1,312 @@
+/*
+ *		SeekGzip asynchronous reads.
+ *
+ * Copyright (c) 2010-2011, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * For conditions of distribution and use, see copyright notice in README
+ * or zlib.h.
+ *
+ * An async queue lets an event loop submit reads without blocking.  A pool
+ * of worker threads serves the submitted requests with seekgzip_pread(),
+ * which reads the compressed data with positioned reads, and moves them to
+ * a completion list.  Every completion bumps a file descriptor (an eventfd
+ * on Linux, a pipe elsewhere) that the loop watches; seekgzip_async_poll()
+ * then runs the callbacks of the completed requests in the calling thread.
+ * At most depth requests are in flight; submitting more fails with
+ * SEEKGZIP_BUSY until some have been polled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "seekgzip.h"
+
+#define ASYNC_THREADS 4			/* default number of workers */
+#define ASYNC_DEPTH 64			/* default number of requests in flight */
+
+struct request {
+	void                  *buffer;
+	int                    size;
+	off_t                  offset;
+	int                    result;
+	seekgzip_async_callback callback;
+	void                  *instance;
+	struct request        *next;
+};
+
+/* A FIFO of requests linked through next. */
+struct list {
+	struct request        *head;
+	struct request        *tail;
+};
+
+struct tag_seekgzip_async {
+	seekgzip_t            *sz;
+	pthread_mutex_t        mutex;
+	pthread_cond_t         submitted;	/* signalled on pending */
+	pthread_cond_t         completed;	/* signalled on done */
+	struct list            pending;
+	struct list            done;
+	struct request        *free;
+	struct request        *requests;
+	int                    inflight;	/* submitted and not yet polled */
+	int                    stop;
+	int                    fd[2];		/* read and write ends of the signal */
+	pthread_t             *threads;
+	int                    nthreads;
+	int                    errorcode;
+};
+
+static void list_push(struct list *l, struct request *r)
+{
+	r->next = NULL;
+	if (l->tail != NULL)
+		l->tail->next = r;
+	else
+		l->head = r;
+	l->tail = r;
+}
+
+static struct request *list_pop(struct list *l)
+{
+	struct request *r = l->head;
+
+	if (r != NULL) {
+		l->head = r->next;
+		if (l->head == NULL)
+			l->tail = NULL;
+	}
+	return r;
+}
+
+static void signal_post(seekgzip_async_t *aq)
+{
+	uint64_t one = 1;
+	ssize_t ret;
+
+	do {
+		ret = write(aq->fd[1], &one, aq->fd[0] == aq->fd[1] ? sizeof(one) : 1);
+	} while (ret < 0 && errno == EINTR);
+}
+
+/* Consume all pending signals; the descriptor is non-blocking. */
+static void signal_drain(seekgzip_async_t *aq)
+{
+	char buffer[64];
+
+	while (read(aq->fd[0], buffer, aq->fd[0] == aq->fd[1] ? sizeof(uint64_t) : sizeof(buffer)) > 0)
+		;
+}
+
+static int signal_open(seekgzip_async_t *aq)
+{
+#ifdef __linux__
+	if( (aq->fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) != -1){
+		aq->fd[1] = aq->fd[0];
+		return 0;
+	}
+#endif
+	if (pipe(aq->fd) != 0) {
+		aq->fd[0] = aq->fd[1] = -1;
+		return -1;
+	}
+	fcntl(aq->fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(aq->fd[1], F_SETFL, O_NONBLOCK);
+	fcntl(aq->fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(aq->fd[1], F_SETFD, FD_CLOEXEC);
+	return 0;
+}
+
+static void *async_worker(void *arg)
+{
+	seekgzip_async_t *aq = (seekgzip_async_t*)arg;
+	struct request *r;
+
+	for (;;) {
+		pthread_mutex_lock(&aq->mutex);
+		while (aq->pending.head == NULL && !aq->stop)
+			pthread_cond_wait(&aq->submitted, &aq->mutex);
+		if( (r = list_pop(&aq->pending)) == NULL){
+			pthread_mutex_unlock(&aq->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&aq->mutex);
+
+		r->result = seekgzip_pread(aq->sz, r->buffer, r->size, r->offset);
+
+		pthread_mutex_lock(&aq->mutex);
+		list_push(&aq->done, r);
+		pthread_cond_broadcast(&aq->completed);
+		pthread_mutex_unlock(&aq->mutex);
+		signal_post(aq);
+	}
+	return NULL;
+}
+
+seekgzip_async_t* seekgzip_async_open(seekgzip_t *sz, int nthreads, int depth)
+{
+	int i;
+	seekgzip_async_t *aq;
+
+	if( (aq = (seekgzip_async_t*)calloc(1, sizeof(seekgzip_async_t))) == NULL)
+		return NULL;
+	aq->sz = sz;
+	aq->fd[0] = aq->fd[1] = -1;
+	if (nthreads < 1)
+		nthreads = ASYNC_THREADS;
+	if (depth < 1)
+		depth = ASYNC_DEPTH;
+	pthread_mutex_init(&aq->mutex, NULL);
+	pthread_cond_init(&aq->submitted, NULL);
+	pthread_cond_init(&aq->completed, NULL);
+
+	if (sz == NULL || seekgzip_error(sz) != SEEKGZIP_SUCCESS) {
+		aq->errorcode = SEEKGZIP_ERROR;
+		goto error_exit;
+	}
+	if( (aq->requests = (struct request*)calloc(depth, sizeof(struct request))) == NULL ||
+		(aq->threads = (pthread_t*)malloc(sizeof(pthread_t) * nthreads)) == NULL){
+		aq->errorcode = SEEKGZIP_OUTOFMEMORY;
+		goto error_exit;
+	}
+	for (i = 0;i < depth;++i) {
+		aq->requests[i].next = aq->free;
+		aq->free = &aq->requests[i];
+	}
+	if (signal_open(aq) != 0) {
+		aq->errorcode = SEEKGZIP_ERROR;
+		goto error_exit;
+	}
+
+	for (aq->nthreads = 0;aq->nthreads < nthreads;++aq->nthreads) {
+		if (pthread_create(&aq->threads[aq->nthreads], NULL, async_worker, aq) != 0)
+			break;
+	}
+	if (aq->nthreads == 0)
+		aq->errorcode = SEEKGZIP_ERROR;
+
+error_exit:
+	return aq;
+}
+
+int seekgzip_async_submit(seekgzip_async_t *aq, void *buffer, int size, off_t offset,
+	seekgzip_async_callback callback, void *instance)
+{
+	struct request *r;
+
+	if (aq->errorcode != SEEKGZIP_SUCCESS)
+		return aq->errorcode;
+
+	pthread_mutex_lock(&aq->mutex);
+	if( (r = aq->free) == NULL){
+		pthread_mutex_unlock(&aq->mutex);
+		return SEEKGZIP_BUSY;
+	}
+	aq->free = r->next;
+	r->buffer = buffer;
+	r->size = size;
+	r->offset = offset;
+	r->result = 0;
+	r->callback = callback;
+	r->instance = instance;
+	list_push(&aq->pending, r);
+	aq->inflight++;
+	pthread_cond_signal(&aq->submitted);
+	pthread_mutex_unlock(&aq->mutex);
+	return SEEKGZIP_SUCCESS;
+}
+
+int seekgzip_async_fd(seekgzip_async_t *aq)
+{
+	return aq->fd[0];
+}
+
+int seekgzip_async_poll(seekgzip_async_t *aq, int max)
+{
+	int n = 0;
+	struct request *r;
+
+	// Drain the signal first: a completion after this re-arms it.
+	signal_drain(aq);
+
+	while (max <= 0 || n < max) {
+		pthread_mutex_lock(&aq->mutex);
+		r = list_pop(&aq->done);
+		pthread_mutex_unlock(&aq->mutex);
+		if (r == NULL)
+			break;
+
+		if (r->callback != NULL)
+			r->callback(r->instance, r->buffer, r->result);
+		n++;
+
+		pthread_mutex_lock(&aq->mutex);
+		r->next = aq->free;
+		aq->free = r;
+		aq->inflight--;
+		pthread_mutex_unlock(&aq->mutex);
+	}
+
+	// Keep the descriptor readable for completions left behind.
+	pthread_mutex_lock(&aq->mutex);
+	r = aq->done.head;
+	pthread_mutex_unlock(&aq->mutex);
+	if (r != NULL)
+		signal_post(aq);
+	return n;
+}
+
+int seekgzip_async_wait(seekgzip_async_t *aq, int max)
+{
+	pthread_mutex_lock(&aq->mutex);
+	while (aq->done.head == NULL && aq->inflight != 0)
+		pthread_cond_wait(&aq->completed, &aq->mutex);
+	pthread_mutex_unlock(&aq->mutex);
+	return seekgzip_async_poll(aq, max);
+}
+
+void seekgzip_async_close(seekgzip_async_t *aq)
+{
+	int i;
+
+	if (aq == NULL)
+		return;
+
+	// Serve what was submitted, then run the remaining callbacks here.
+	pthread_mutex_lock(&aq->mutex);
+	aq->stop = 1;
+	pthread_cond_broadcast(&aq->submitted);
+	pthread_mutex_unlock(&aq->mutex);
+	for (i = 0;i < aq->nthreads;++i)
+		pthread_join(aq->threads[i], NULL);
+	if (aq->fd[0] != -1)
+		seekgzip_async_poll(aq, 0);
+
+	if (aq->fd[0] != -1)
+		close(aq->fd[0]);
+	if (aq->fd[1] != -1 && aq->fd[1] != aq->fd[0])
+		close(aq->fd[1]);
+	pthread_cond_destroy(&aq->completed);
+	pthread_cond_destroy(&aq->submitted);
+	pthread_mutex_destroy(&aq->mutex);
+	free(aq->threads);
+	free(aq->requests);
+	free(aq);
+}
+
+int seekgzip_async_error(seekgzip_async_t *aq)
+{
+	if (aq == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+
+	return aq->errorcode;
+}
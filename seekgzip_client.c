@@ -0,0 +1,200 @@
+/*
+ *		SeekGzip client library for seekgzipd.
+ *
+ * Copyright (c) 2010-2011, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * For conditions of distribution and use, see copyright notice in README
+ * or zlib.h.
+ *
+ * The client mirrors seekgzip_open/seek/read, but forwards reads to a
+ * seekgzipd daemon over a Unix domain socket instead of loading the index
+ * and decompressing in the calling process.  See seekgzipd.c for the
+ * protocol.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "seekgzip.h"
+#include "seekgzip_client.h"
+
+struct tag_seekgzip_client {
+	char                  *path_data;
+	int                    fd;
+	FILE                  *in;		/* buffered reader of replies */
+	off_t                  offset;
+	off_t                  totin;
+	off_t                  totout;
+	int                    errorcode;
+	int                    pending;		/* error held back by a short read */
+};
+
+static int write_all(int fd, const char *buf, size_t size)
+{
+	ssize_t n;
+
+	while (0 < size) {
+		n = write(fd, buf, size);
+		if (n <= 0)
+			return -1;
+		buf += n;
+		size -= n;
+	}
+	return 0;
+}
+
+/* Read a reply line: "OK ..." yields the arguments, "ERR <code>" the code. */
+static int read_reply(seekgzip_client_t *zc, char *line, size_t size)
+{
+	if (fgets(line, size, zc->in) == NULL)
+		return SEEKGZIP_READERROR;
+	if (strncmp(line, "OK", 2) == 0)
+		return SEEKGZIP_SUCCESS;
+	if (strncmp(line, "ERR ", 4) == 0)
+		return atoi(line + 4);
+	return SEEKGZIP_IMCOMPATIBLE;
+}
+
+seekgzip_client_t* seekgzip_client_open(const char *socket_path, const char *target)
+{
+	char line[PATH_MAX + 64];
+	intmax_t totout, totin;
+	struct sockaddr_un addr;
+	seekgzip_client_t *zc;
+
+	if( (zc = (seekgzip_client_t *)calloc(1, sizeof(seekgzip_client_t))) == NULL)
+		return NULL;
+	zc->fd = -1;
+
+	if (socket_path == NULL)
+		socket_path = getenv("SEEKGZIPD_SOCKET");
+	if (socket_path == NULL)
+		socket_path = SEEKGZIPD_SOCKET;
+
+	// The daemon does not share our working directory.
+	if( (zc->path_data = realpath(target, NULL)) == NULL){
+		zc->errorcode = SEEKGZIP_OPENERROR;
+		goto error_exit;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	if( (zc->fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+		connect(zc->fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+		(zc->in = fdopen(dup(zc->fd), "r")) == NULL){
+		zc->errorcode = SEEKGZIP_OPENERROR;
+		goto error_exit;
+	}
+
+	snprintf(line, sizeof(line), "OPEN %s\n", zc->path_data);
+	if (write_all(zc->fd, line, strlen(line)) != 0) {
+		zc->errorcode = SEEKGZIP_WRITEERROR;
+		goto error_exit;
+	}
+	if( (zc->errorcode = read_reply(zc, line, sizeof(line))) != SEEKGZIP_SUCCESS)
+		goto error_exit;
+	if (sscanf(line, "OK %jd %jd", &totout, &totin) != 2) {
+		zc->errorcode = SEEKGZIP_IMCOMPATIBLE;
+		goto error_exit;
+	}
+	zc->totout = (off_t)totout;
+	zc->totin = (off_t)totin;
+
+error_exit:
+	return zc;
+}
+
+void seekgzip_client_close(seekgzip_client_t* zc)
+{
+	if (zc == NULL)
+		return;
+
+	if (zc->in != NULL)
+		fclose(zc->in);
+	if (zc->fd != -1)
+		close(zc->fd);
+	free(zc->path_data);
+	free(zc);
+}
+
+void seekgzip_client_seek(seekgzip_client_t *zc, off_t offset)
+{
+	zc->offset = offset;
+}
+
+off_t seekgzip_client_tell(seekgzip_client_t *zc)
+{
+	return zc->offset;
+}
+
+off_t seekgzip_client_unpacked_length(seekgzip_client_t *zc)
+{
+	return zc->totout;
+}
+
+off_t seekgzip_client_packed_length(seekgzip_client_t *zc)
+{
+	return zc->totin;
+}
+
+int seekgzip_client_read(seekgzip_client_t* zc, void *buffer, int size)
+{
+	int ret, len, n = 0;
+	char line[PATH_MAX + 64];
+
+	// An error after some data was returned is reported on the next call.
+	if (zc->pending != SEEKGZIP_SUCCESS) {
+		ret = zc->pending;
+		zc->pending = SEEKGZIP_SUCCESS;
+		return ret;
+	}
+
+	while (n < size) {
+		len = size - n;
+		if (SEEKGZIPD_MAX_READ < len)
+			len = SEEKGZIPD_MAX_READ;
+
+		snprintf(line, sizeof(line), "READ %jd %d %s\n", (intmax_t)zc->offset, len, zc->path_data);
+		if (write_all(zc->fd, line, strlen(line)) != 0) {
+			ret = SEEKGZIP_WRITEERROR;
+			goto error_exit;
+		}
+		if( (ret = read_reply(zc, line, sizeof(line))) != SEEKGZIP_SUCCESS)
+			goto error_exit;
+		if (sscanf(line, "OK %d", &ret) != 1 || ret < 0 || len < ret) {
+			ret = SEEKGZIP_IMCOMPATIBLE;
+			goto error_exit;
+		}
+		if (fread((char*)buffer + n, 1, ret, zc->in) != (size_t)ret) {
+			ret = SEEKGZIP_READERROR;
+			goto error_exit;
+		}
+
+		zc->offset += ret;
+		n += ret;
+		if (ret < len)
+			break;
+	}
+	return n;
+
+error_exit:
+	if (n == 0)
+		return ret;
+	zc->pending = ret;
+	return n;
+}
+
+int seekgzip_client_error(seekgzip_client_t* zc)
+{
+	if (zc == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+
+	return zc->errorcode;
+}
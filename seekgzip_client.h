@@ -0,0 +1,53 @@
+#ifndef __SEEKGZIP_CLIENT_H__
+#define __SEEKGZIP_CLIENT_H__
+
+#include <sys/types.h>
+
+/* Default socket of seekgzipd, overridden by $SEEKGZIPD_SOCKET. */
+#define SEEKGZIPD_SOCKET "/tmp/seekgzipd.sock"
+
+/* Largest range requested from seekgzipd in one round trip. */
+#define SEEKGZIPD_MAX_READ (16 << 20)
+
+struct tag_seekgzip_client; typedef struct tag_seekgzip_client seekgzip_client_t;
+
+seekgzip_client_t*
+seekgzip_client_open(
+	const char *socket,
+	const char *filename
+	);
+
+void
+seekgzip_client_close(
+	seekgzip_client_t* zc
+	);
+
+void
+seekgzip_client_seek(
+	seekgzip_client_t *zc,
+	off_t offset
+	);
+
+off_t
+seekgzip_client_tell(
+	seekgzip_client_t *zc
+	);
+
+/* Like seekgzip_read(); an error that follows part of the data is returned
+   by the next call instead. */
+int
+seekgzip_client_read(
+	seekgzip_client_t* zc,
+	void *buffer,
+	int size
+	);
+
+int
+seekgzip_client_error(
+	seekgzip_client_t* zc
+	);
+
+off_t seekgzip_client_unpacked_length(seekgzip_client_t *zc);
+off_t seekgzip_client_packed_length(seekgzip_client_t *zc);
+
+#endif/*__SEEKGZIP_CLIENT_H__*/
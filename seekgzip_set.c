@@ -0,0 +1,212 @@
+/*
+ *		SeekGzip multi-file streams.
+ *
+ * Copyright (c) 2010-2011, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * For conditions of distribution and use, see copyright notice in README
+ * or zlib.h.
+ *
+ * A set presents an ordered list of gzip files (e.g., rotated logs) as one
+ * uncompressed stream.  The uncompressed lengths of the files, taken from
+ * their indexes, form a prefix-sum table that maps a global offset to a
+ * file by binary search.  Files are opened when first read, and at most
+ * maxopen of them are kept open, closing the least recently used one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "seekgzip.h"
+
+#define SET_MAXOPEN 16			/* default limit of open files */
+
+struct member {
+	char                  *path;
+	off_t                  begin;		/* global offset of the first byte */
+	seekgzip_t            *sz;		/* NULL while closed */
+	unsigned long          stamp;		/* last use, for LRU replacement */
+};
+
+struct tag_seekgzip_set {
+	struct member         *members;
+	int                    n;
+	int                    maxopen;
+	int                    nopen;
+	int                    flags;
+	unsigned long          clock;
+	off_t                  offset;
+	off_t                  totout;
+	int                    errorcode;
+};
+
+static void member_close(seekgzip_set_t *zset, struct member *m)
+{
+	if (m->sz != NULL) {
+		seekgzip_close(m->sz);
+		m->sz = NULL;
+		zset->nopen--;
+	}
+}
+
+/* Return an open handle for member i, evicting the least recently used. */
+static seekgzip_t *member_get(seekgzip_set_t *zset, int i, int *error)
+{
+	int j;
+	struct member *m = &zset->members[i], *victim;
+
+	m->stamp = ++zset->clock;
+	if (m->sz != NULL)
+		return m->sz;
+
+	while (zset->maxopen <= zset->nopen) {
+		victim = NULL;
+		for (j = 0;j < zset->n;++j) {
+			if (zset->members[j].sz != NULL &&
+				(victim == NULL || zset->members[j].stamp < victim->stamp))
+				victim = &zset->members[j];
+		}
+		member_close(zset, victim);
+	}
+
+	m->sz = seekgzip_open(m->path, zset->flags);
+	if( (*error = seekgzip_error(m->sz)) != SEEKGZIP_SUCCESS){
+		seekgzip_close(m->sz);
+		m->sz = NULL;
+		return NULL;
+	}
+	zset->nopen++;
+	return m->sz;
+}
+
+seekgzip_set_t* seekgzip_set_open(const char **filenames, int n, int maxopen, int flags)
+{
+	int i;
+	off_t unpacked, packed;
+	seekgzip_t *sz;
+	seekgzip_set_t *zset;
+
+	if( (zset = (seekgzip_set_t*)calloc(1, sizeof(seekgzip_set_t))) == NULL)
+		return NULL;
+	zset->maxopen = 0 < maxopen ? maxopen : SET_MAXOPEN;
+	zset->flags = flags;
+
+	if( (zset->members = (struct member*)calloc(n, sizeof(struct member))) == NULL){
+		zset->errorcode = SEEKGZIP_OUTOFMEMORY;
+		goto error_exit;
+	}
+	zset->n = n;
+
+	// Build the prefix sums, reading only index headers where possible.
+	for (i = 0;i < n;++i) {
+		struct member *m = &zset->members[i];
+		if( (m->path = strdup(filenames[i])) == NULL){
+			zset->errorcode = SEEKGZIP_OUTOFMEMORY;
+			goto error_exit;
+		}
+		m->begin = zset->totout;
+		if (seekgzip_peek(m->path, &unpacked, &packed) != SEEKGZIP_SUCCESS) {
+			if( (sz = member_get(zset, i, &zset->errorcode)) == NULL)
+				goto error_exit;
+			unpacked = seekgzip_unpacked_length(sz);
+		}
+		zset->totout += unpacked;
+	}
+
+error_exit:
+	return zset;
+}
+
+void seekgzip_set_close(seekgzip_set_t* zset)
+{
+	int i;
+
+	if (zset == NULL)
+		return;
+
+	for (i = 0;i < zset->n;++i) {
+		member_close(zset, &zset->members[i]);
+		free(zset->members[i].path);
+	}
+	free(zset->members);
+	free(zset);
+}
+
+void seekgzip_set_seek(seekgzip_set_t *zset, off_t offset)
+{
+	zset->offset = offset;
+}
+
+off_t seekgzip_set_tell(seekgzip_set_t *zset)
+{
+	return zset->offset;
+}
+
+off_t seekgzip_set_unpacked_length(seekgzip_set_t *zset)
+{
+	return zset->totout;
+}
+
+int seekgzip_set_locate(seekgzip_set_t *zset, off_t offset, off_t *local)
+{
+	int half, first = 0, len = zset->n;
+
+	if (offset < 0 || zset->totout <= offset)
+		return -1;
+
+	/* the last member that begins at or before offset; empty files share
+	   their begin with the next one and are skipped by upper_bound */
+	while (0 < len) {
+		half = len >> 1;
+		if (offset < zset->members[first + half].begin) {
+			len = half;
+		} else {
+			first += half + 1;
+			len -= half + 1;
+		}
+	}
+	if (local != NULL)
+		*local = offset - zset->members[first - 1].begin;
+	return first - 1;
+}
+
+int seekgzip_set_read(seekgzip_set_t* zset, void *buffer, int size)
+{
+	int i, ret, n = 0, len;
+	off_t local, end;
+	seekgzip_t *sz;
+
+	while (n < size) {
+		if( (i = seekgzip_set_locate(zset, zset->offset, &local)) < 0)
+			break;
+		if( (sz = member_get(zset, i, &ret)) == NULL){
+			zset->errorcode = ret;
+			return n ? n : ret;
+		}
+
+		/* read up to the end of this member */
+		end = i + 1 < zset->n ? zset->members[i + 1].begin : zset->totout;
+		len = size - n;
+		if (end - zset->offset < len)
+			len = (int)(end - zset->offset);
+		seekgzip_seek(sz, local);
+		ret = seekgzip_read(sz, (char*)buffer + n, len);
+		if (ret <= 0) {
+			/* the member is shorter than its index said */
+			if (ret == 0)
+				ret = SEEKGZIP_DATAERROR;
+			return n ? n : ret;
+		}
+		n += ret;
+		zset->offset += ret;
+	}
+	return n;
+}
+
+int seekgzip_set_error(seekgzip_set_t* zset)
+{
+	if (zset == NULL)
+		return SEEKGZIP_OUTOFMEMORY;
+
+	return zset->errorcode;
+}
@@ -0,0 +1,507 @@
+/*
+ *		SeekGzip data sources.
+ *
+ * Copyright (c) 2010-2011, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * For conditions of distribution and use, see copyright notice in README
+ * or zlib.h.
+ *
+ * A source provides positioned reads of the compressed data.  Two
+ * implementations are provided: local files read with pread(), and objects
+ * served over HTTP that are fetched piecewise with Range requests.
+ */
+
+#define _GNU_SOURCE		/* timegm() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include "seekgzip.h"
+
+/*===== Local files ===== {{{*/
+
+struct file_source {
+	seekgzip_source_t      base;
+	int                    fd;
+};
+
+static ssize_t file_read_at(seekgzip_source_t *src, void *buffer, size_t size, off_t offset)
+{
+	struct file_source *fs = (struct file_source*)src;
+	return pread(fs->fd, buffer, size, offset);
+}
+
+static off_t file_size(seekgzip_source_t *src)
+{
+	struct stat st;
+	struct file_source *fs = (struct file_source*)src;
+	return fstat(fs->fd, &st) == 0 ? st.st_size : (off_t)-1;
+}
+
+static time_t file_mtime(seekgzip_source_t *src)
+{
+	struct stat st;
+	struct file_source *fs = (struct file_source*)src;
+	return fstat(fs->fd, &st) == 0 ? st.st_mtime : (time_t)-1;
+}
+
+static void file_close(seekgzip_source_t *src)
+{
+	struct file_source *fs = (struct file_source*)src;
+	close(fs->fd);
+	free(fs);
+}
+
+seekgzip_source_t* seekgzip_source_file(const char *path)
+{
+	struct file_source *fs;
+
+	if( (fs = (struct file_source*)calloc(1, sizeof(struct file_source))) == NULL)
+		return NULL;
+	if( (fs->fd = open(path, O_RDONLY)) == -1){
+		free(fs);
+		return NULL;
+	}
+	fs->base.read_at = file_read_at;
+	fs->base.size = file_size;
+	fs->base.mtime = file_mtime;
+	fs->base.close = file_close;
+	return &fs->base;
+}
+
+/*===== End of local files ===== }}}*/
+
+/*===== HTTP ===== {{{*/
+
+/* The object is read in blocks of HTTP_BLOCK bytes that are kept in a small
+   LRU cache.  A miss fetches a run of consecutive missing blocks with one
+   Range request; when misses continue where the previous fetch ended, the
+   run doubles up to HTTP_MAXRUN blocks, so that sequential decoding issues
+   few round trips while a random read only fetches what it touches.  The
+   mutex only guards the cache: every fetch takes a kept-alive connection
+   from a pool, so concurrent readers wait on the network in parallel. */
+
+#define HTTP_BLOCK 65536
+#define HTTP_MAXRUN 16
+#define HTTP_CACHE 256			/* number of cached blocks */
+#define HTTP_LINE 8192
+
+struct http_block {
+	off_t                  id;		/* block number, or -1 if unused */
+	unsigned               stamp;		/* last use, for LRU replacement */
+	size_t                 size;
+	unsigned char          data[HTTP_BLOCK];
+};
+
+struct http_conn {
+	int                    sock;		/* -1 once disconnected */
+	FILE                  *in;
+	struct http_conn      *next;		/* in the idle list */
+};
+
+struct http_source {
+	seekgzip_source_t      base;
+	pthread_mutex_t        mutex;
+	char                  *host;
+	char                  *port;
+	char                  *path;
+	struct http_conn      *idle;		/* kept-alive connections */
+	off_t                  size;
+	time_t                 mtime;
+	off_t                  next;		/* block after the last fetch */
+	int                    run;		/* length of the last fetch */
+	unsigned               clock;
+	struct http_block     *blocks;
+};
+
+static void http_disconnect(struct http_conn *c)
+{
+	if (c->in != NULL)
+		fclose(c->in);
+	if (c->sock != -1)
+		close(c->sock);
+	c->in = NULL;
+	c->sock = -1;
+}
+
+static int http_connect(struct http_source *hs, struct http_conn *c)
+{
+	struct addrinfo hints, *res, *ai;
+
+	if (c->sock != -1)
+		return 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(hs->host, hs->port, &hints, &res) != 0)
+		return -1;
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		c->sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (c->sock == -1)
+			continue;
+		if (connect(c->sock, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(c->sock);
+		c->sock = -1;
+	}
+	freeaddrinfo(res);
+	if (c->sock == -1)
+		return -1;
+
+	if( (c->in = fdopen(dup(c->sock), "r")) == NULL){
+		http_disconnect(c);
+		return -1;
+	}
+	return 0;
+}
+
+/* Take an idle connection, or a new unconnected one. */
+static struct http_conn *http_acquire(struct http_source *hs)
+{
+	struct http_conn *c;
+
+	pthread_mutex_lock(&hs->mutex);
+	if( (c = hs->idle) != NULL)
+		hs->idle = c->next;
+	pthread_mutex_unlock(&hs->mutex);
+	if (c == NULL && (c = (struct http_conn*)calloc(1, sizeof(*c))) != NULL)
+		c->sock = -1;
+	return c;
+}
+
+/* Keep a connection that is still alive for later fetches. */
+static void http_release(struct http_source *hs, struct http_conn *c)
+{
+	if (c->sock == -1) {
+		free(c);
+		return;
+	}
+	pthread_mutex_lock(&hs->mutex);
+	c->next = hs->idle;
+	hs->idle = c;
+	pthread_mutex_unlock(&hs->mutex);
+}
+
+static time_t http_date(const char *value)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	if (strptime(value, "%a, %d %b %Y %H:%M:%S", &tm) == NULL)
+		return (time_t)-1;
+	return timegm(&tm);
+}
+
+/* Fetch bytes [begin, end) into buf over c, storing the object size (or -1)
+   in *total and its modification time in *mtime.  Returns the number of
+   bytes received (short only at the end of the object) or -1, also when a
+   partial response does not start at begin. */
+static ssize_t http_get(struct http_source *hs, struct http_conn *c, unsigned char *buf,
+	off_t begin, off_t end, int retry, off_t *total, time_t *mtime)
+{
+	int status = 0, keepalive = 1;
+	char line[HTTP_LINE];
+	off_t length = -1, first = -1, last = -1;
+	size_t n, len;
+
+	*total = -1;
+	if (http_connect(hs, c) != 0)
+		return -1;
+
+	snprintf(line, sizeof(line),
+		"GET %s HTTP/1.1\r\n"
+		"Host: %s\r\n"
+		"Range: bytes=%jd-%jd\r\n"
+		"Connection: keep-alive\r\n"
+		"\r\n",
+		hs->path, hs->host, (intmax_t)begin, (intmax_t)end - 1);
+	len = strlen(line);
+	for (n = 0; n < len; ) {
+		ssize_t w = send(c->sock, line + n, len - n, MSG_NOSIGNAL);
+		if (w <= 0)
+			goto error_exit;
+		n += w;
+	}
+
+	/* status line and headers */
+	if (fgets(line, sizeof(line), c->in) == NULL ||
+		sscanf(line, "HTTP/%*d.%*d %d", &status) != 1)
+		goto error_exit;
+	while (fgets(line, sizeof(line), c->in) != NULL) {
+		intmax_t a, b, t;
+		if (strcmp(line, "\r\n") == 0 || strcmp(line, "\n") == 0)
+			break;
+		if (strncasecmp(line, "Content-Length:", 15) == 0) {
+			length = (off_t)strtoll(line + 15, NULL, 10);
+		} else if (strncasecmp(line, "Content-Range:", 14) == 0) {
+			if (sscanf(line + 14, " bytes %jd-%jd/%jd", &a, &b, &t) == 3) {
+				first = (off_t)a;
+				last = (off_t)b;
+				*total = (off_t)t;
+			} else if (sscanf(line + 14, " bytes */%jd", &t) == 1)
+				*total = (off_t)t;
+		} else if (strncasecmp(line, "Last-Modified:", 14) == 0) {
+			*mtime = http_date(line + 14 + strspn(line + 14, " "));
+		} else if (strncasecmp(line, "Connection:", 11) == 0) {
+			if (strstr(line + 11, "close") != NULL)
+				keepalive = 0;
+		} else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+			if (strstr(line + 18, "chunked") != NULL)
+				goto error_exit;
+		}
+	}
+
+	if (status == 416) {
+		/* the range starts at or after the end of the object */
+		len = 0;
+	} else if (status == 206 && 0 <= length) {
+		/* a range other than the one asked for would land at the wrong offset */
+		if (first != begin || last - first + 1 != length || (off_t)length > end - begin)
+			goto error_exit;
+		len = (size_t)length;
+	} else if (status == 200 && 0 <= length && begin == 0) {
+		/* the server ignored Range; take the head and drop the connection */
+		*total = length;
+		len = (size_t)(length < end ? length : end);
+		keepalive = 0;
+	} else {
+		goto error_exit;
+	}
+
+	if (len != 0 && fread(buf, 1, len, c->in) != len)
+		goto error_exit;
+	if (status == 416 && 0 < length) {
+		while (0 < length-- && fgetc(c->in) != EOF)
+			;
+	}
+	if (!keepalive)
+		http_disconnect(c);
+	return (ssize_t)len;
+
+error_exit:
+	/* a kept-alive connection may have been closed by the server */
+	http_disconnect(c);
+	if (retry)
+		return http_get(hs, c, buf, begin, end, 0, total, mtime);
+	return -1;
+}
+
+static struct http_block *http_lookup(struct http_source *hs, off_t id)
+{
+	int i;
+	for (i = 0;i < HTTP_CACHE;++i) {
+		if (hs->blocks[i].id == id) {
+			hs->blocks[i].stamp = ++hs->clock;
+			return &hs->blocks[i];
+		}
+	}
+	return NULL;
+}
+
+static struct http_block *http_victim(struct http_source *hs)
+{
+	int i;
+	struct http_block *victim = &hs->blocks[0];
+	for (i = 1;i < HTTP_CACHE;++i) {
+		if (hs->blocks[i].stamp < victim->stamp)
+			victim = &hs->blocks[i];
+	}
+	return victim;
+}
+
+/* Fetch the run of missing blocks starting at block id.  Called with the
+   mutex held, which is released during the fetch. */
+static int http_fill(struct http_source *hs, off_t id, off_t last)
+{
+	int i, run;
+	ssize_t got;
+	off_t begin, end, total;
+	time_t mtime;
+	unsigned char *buf;
+	struct http_block *b;
+	struct http_conn *c;
+
+	run = (id == hs->next) ? hs->run * 2 : 1;
+	if (HTTP_MAXRUN < run)
+		run = HTTP_MAXRUN;
+	if (run < last - id + 1)
+		run = (int)(last - id + 1 < HTTP_MAXRUN ? last - id + 1 : HTTP_MAXRUN);
+	for (i = 1;i < run;++i) {
+		if (hs->size <= (id + i) * HTTP_BLOCK || http_lookup(hs, id + i) != NULL)
+			break;
+	}
+	run = i;
+	hs->next = id + run;
+	hs->run = run;
+
+	begin = id * HTTP_BLOCK;
+	end = begin + (off_t)run * HTTP_BLOCK;
+	if (hs->size < end)
+		end = hs->size;
+	if( (buf = (unsigned char*)malloc((size_t)(end - begin))) == NULL)
+		return -1;
+
+	pthread_mutex_unlock(&hs->mutex);
+	if( (c = http_acquire(hs)) != NULL){
+		got = http_get(hs, c, buf, begin, end, 1, &total, &mtime);
+		http_release(hs, c);
+	} else {
+		got = -1;
+	}
+	pthread_mutex_lock(&hs->mutex);
+	if (got < 0) {
+		free(buf);
+		return -1;
+	}
+
+	for (i = 0;(off_t)i * HTTP_BLOCK < got;++i) {
+		/* another reader may have fetched the block meanwhile */
+		if( (b = http_lookup(hs, id + i)) == NULL)
+			b = http_victim(hs);
+		b->id = id + i;
+		b->stamp = ++hs->clock;
+		b->size = (size_t)(got - (off_t)i * HTTP_BLOCK);
+		if (HTTP_BLOCK < b->size)
+			b->size = HTTP_BLOCK;
+		memcpy(b->data, buf + (size_t)i * HTTP_BLOCK, b->size);
+	}
+	free(buf);
+	return 0;
+}
+
+static ssize_t http_read_at(seekgzip_source_t *src, void *buffer, size_t size, off_t offset)
+{
+	struct http_source *hs = (struct http_source*)src;
+	struct http_block *b;
+	unsigned char *p = (unsigned char*)buffer;
+	off_t id, last;
+	size_t n = 0, len, skip;
+
+	pthread_mutex_lock(&hs->mutex);
+	if (hs->size <= offset)
+		size = 0;
+	else if ((off_t)size > hs->size - offset)
+		size = (size_t)(hs->size - offset);
+	last = (offset + (off_t)size - 1) / HTTP_BLOCK;
+
+	while (n < size) {
+		id = (offset + (off_t)n) / HTTP_BLOCK;
+		if( (b = http_lookup(hs, id)) == NULL){
+			if (http_fill(hs, id, last) != 0 || (b = http_lookup(hs, id)) == NULL) {
+				pthread_mutex_unlock(&hs->mutex);
+				errno = EIO;
+				return -1;
+			}
+		}
+		skip = (size_t)(offset + (off_t)n - id * HTTP_BLOCK);
+		if (b->size <= skip)
+			break;
+		len = b->size - skip;
+		if (size - n < len)
+			len = size - n;
+		memcpy(p + n, b->data + skip, len);
+		n += len;
+	}
+	pthread_mutex_unlock(&hs->mutex);
+	return (ssize_t)n;
+}
+
+static off_t http_size(seekgzip_source_t *src)
+{
+	return ((struct http_source*)src)->size;
+}
+
+static time_t http_mtime(seekgzip_source_t *src)
+{
+	return ((struct http_source*)src)->mtime;
+}
+
+static void http_close(seekgzip_source_t *src)
+{
+	struct http_source *hs = (struct http_source*)src;
+	struct http_conn *c;
+
+	while ((c = hs->idle) != NULL) {
+		hs->idle = c->next;
+		http_disconnect(c);
+		free(c);
+	}
+	pthread_mutex_destroy(&hs->mutex);
+	free(hs->blocks);
+	free(hs->host);
+	free(hs->port);
+	free(hs->path);
+	free(hs);
+}
+
+int seekgzip_is_url(const char *target)
+{
+	return strncmp(target, "http://", 7) == 0;
+}
+
+seekgzip_source_t* seekgzip_source_http(const char *url)
+{
+	int i;
+	const char *host, *slash, *colon;
+	unsigned char probe;
+	struct http_source *hs;
+	struct http_conn *c;
+
+	if (!seekgzip_is_url(url))
+		return NULL;
+	if( (hs = (struct http_source*)calloc(1, sizeof(struct http_source))) == NULL)
+		return NULL;
+	hs->mtime = (time_t)-1;
+	hs->size = (off_t)-1;
+	hs->next = -1;
+	pthread_mutex_init(&hs->mutex, NULL);
+
+	/* split http://host[:port]/path */
+	host = url + 7;
+	slash = strchr(host, '/');
+	if (slash == NULL)
+		slash = host + strlen(host);
+	colon = memchr(host, ':', slash - host);
+	hs->host = strndup(host, (colon ? colon : slash) - host);
+	hs->port = colon ? strndup(colon + 1, slash - colon - 1) : strdup("80");
+	hs->path = strdup(*slash ? slash : "/");
+	hs->blocks = (struct http_block*)malloc(sizeof(struct http_block) * HTTP_CACHE);
+	if (hs->host == NULL || hs->port == NULL || hs->path == NULL || hs->blocks == NULL)
+		goto error_exit;
+	for (i = 0;i < HTTP_CACHE;++i) {
+		hs->blocks[i].id = -1;
+		hs->blocks[i].stamp = 0;
+	}
+
+	/* a one-byte request tells the object size and modification time */
+	if( (c = http_acquire(hs)) == NULL)
+		goto error_exit;
+	if (http_get(hs, c, &probe, 0, 1, 0, &hs->size, &hs->mtime) < 0 || hs->size < 0) {
+		http_release(hs, c);
+		goto error_exit;
+	}
+	http_release(hs, c);
+
+	hs->base.read_at = http_read_at;
+	hs->base.size = http_size;
+	hs->base.mtime = http_mtime;
+	hs->base.close = http_close;
+	return &hs->base;
+
+error_exit:
+	http_close(&hs->base);
+	return NULL;
+}
+
+/*===== End of HTTP ===== }}}*/
@@ -0,0 +1,521 @@
+/*
+ *		SeekGzip range-read daemon.
+ *
+ * Copyright (c) 2010-2011, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * For conditions of distribution and use, see copyright notice in README
+ * or zlib.h.
+ *
+ * seekgzipd keeps the indexes of the gzip files it has been asked about
+ * resident, together with a cache of decompressed spans per file, and
+ * serves range reads to local processes over a Unix domain socket.  A
+ * connection carries a sequence of newline-terminated requests:
+ *
+ *	OPEN <path>			-> OK <unpacked-length> <packed-length>
+ *	READ <offset> <size> <path>	-> OK <n>, followed by n bytes of data
+ *
+ * Any request may be answered with "ERR <code>" instead, where <code> is
+ * one of the SEEKGZIP_* error codes.  Paths are absolute.
+ *
+ * The main thread polls the idle connections and hands a connection with
+ * input to a worker, which serves the requests received so far and gives
+ * the connection back, so an idle client does not tie up a worker.  At
+ * most MAX_FILES files are kept open; the least recently used one is
+ * closed to make room.  A reply that a client does not take within
+ * SEND_TIMEOUT seconds closes its connection, so a stalled client cannot
+ * hold a worker either.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "seekgzip.h"
+#include "seekgzip_client.h"
+
+#define NUM_THREADS 8			/* default size of the worker pool */
+#define CACHE_SIZE 64			/* default span cache per file (MiB) */
+#define MAX_FILES 64			/* default number of files kept open */
+#define SEND_TIMEOUT 30			/* default seconds a reply may block */
+#define LINE_SIZE (PATH_MAX + 64)
+
+/* An opened gzip file, shared by all connections. */
+struct file {
+	char                  *path;
+	seekgzip_t            *sz;
+	time_t                 mtime;
+	off_t                  size;
+	int                    state;		/* FILE_LOADING or an error code */
+	int                    refs;
+	unsigned long          stamp;		/* last use, for LRU replacement */
+	struct file           *next;
+};
+
+#define FILE_LOADING 1
+
+/* A client connection, owned by the main thread while idle. */
+struct conn {
+	int                    fd;
+	int                    busy;		/* handed to a worker */
+	int                    closed;		/* to be closed by the main thread */
+	size_t                 len;		/* bytes of input in line */
+	char                   line[LINE_SIZE];
+	struct conn           *next;		/* in conns */
+	struct conn           *ready;		/* in the queue */
+};
+
+/* Connections with input, waiting for a worker. */
+struct queue {
+	pthread_mutex_t        mutex;
+	pthread_cond_t         cond;
+	struct conn           *head, *tail;
+};
+
+static pthread_mutex_t files_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t files_cond = PTHREAD_COND_INITIALIZER;
+static struct file *files = NULL;
+static int nfiles = 0, max_files = MAX_FILES;
+static unsigned long files_clock = 0;
+static size_t cache_size = (size_t)CACHE_SIZE << 20;
+static int send_timeout = SEND_TIMEOUT;
+static struct queue queue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL };
+
+static pthread_mutex_t conns_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct conn *conns = NULL;
+static int wake[2];			/* tells the main thread a connection is idle */
+
+static void file_release(struct file *f)
+{
+	int refs;
+
+	pthread_mutex_lock(&files_mutex);
+	refs = --f->refs;
+	pthread_mutex_unlock(&files_mutex);
+
+	if (refs == 0) {
+		seekgzip_close(f->sz);
+		free(f->path);
+		free(f);
+	}
+}
+
+/* Unlink f from the table; called with files_mutex held. */
+static void file_remove(struct file *f)
+{
+	struct file **p;
+
+	for (p = &files; *p != NULL; p = &(*p)->next) {
+		if (*p == f) {
+			*p = f->next;
+			f->refs--;
+			nfiles--;
+			break;
+		}
+	}
+}
+
+/* Unlink f and close it unless a reader still holds it; called with
+   files_mutex held. */
+static void file_drop(struct file *f)
+{
+	file_remove(f);
+	if (f->refs == 0) {
+		seekgzip_close(f->sz);
+		free(f->path);
+		free(f);
+	}
+}
+
+/* Close least recently used files beyond max_files, except keep; called
+   with files_mutex held. */
+static void file_evict(struct file *keep)
+{
+	struct file *f, *victim;
+
+	while (max_files < nfiles) {
+		victim = NULL;
+		for (f = files; f != NULL; f = f->next) {
+			if (f != keep && f->state != FILE_LOADING &&
+				(victim == NULL || f->stamp < victim->stamp))
+				victim = f;
+		}
+		if (victim == NULL)
+			break;
+		file_drop(victim);
+	}
+}
+
+/* Look up (or open) the file at path.  Opening may have to build the index,
+   so it runs outside the table lock; concurrent requests for the same file
+   wait for the first one.  A file that changed on disk since it was opened
+   is reopened, while readers of the old handle keep their reference. */
+static struct file *file_acquire(const char *path, int *error)
+{
+	struct stat st;
+	struct file *f;
+
+	if (stat(path, &st) != 0) {
+		*error = SEEKGZIP_OPENERROR;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&files_mutex);
+	for (f = files; f != NULL; f = f->next) {
+		if (strcmp(f->path, path) == 0)
+			break;
+	}
+	if (f != NULL && f->state == SEEKGZIP_SUCCESS &&
+		(f->mtime != st.st_mtime || f->size != st.st_size)) {
+		file_drop(f);
+		f = NULL;
+	}
+
+	if (f == NULL) {
+		if( (f = (struct file*)calloc(1, sizeof(struct file))) == NULL ||
+			(f->path = strdup(path)) == NULL){
+			free(f);
+			pthread_mutex_unlock(&files_mutex);
+			*error = SEEKGZIP_OUTOFMEMORY;
+			return NULL;
+		}
+		f->state = FILE_LOADING;
+		f->mtime = st.st_mtime;
+		f->size = st.st_size;
+		f->refs = 2;
+		f->stamp = ++files_clock;
+		f->next = files;
+		files = f;
+		nfiles++;
+		file_evict(f);
+		pthread_mutex_unlock(&files_mutex);
+
+		f->sz = seekgzip_open(path, 0);
+		if( (*error = seekgzip_error(f->sz)) == SEEKGZIP_SUCCESS)
+			*error = seekgzip_cache(f->sz, cache_size);
+
+		pthread_mutex_lock(&files_mutex);
+		f->state = *error;
+		if (*error != SEEKGZIP_SUCCESS)
+			file_remove(f);
+		pthread_cond_broadcast(&files_cond);
+	} else {
+		f->refs++;
+		f->stamp = ++files_clock;
+		while (f->state == FILE_LOADING)
+			pthread_cond_wait(&files_cond, &files_mutex);
+		*error = f->state;
+	}
+	pthread_mutex_unlock(&files_mutex);
+
+	if (*error != SEEKGZIP_SUCCESS) {
+		file_release(f);
+		return NULL;
+	}
+	return f;
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+	const char *p = (const char*)buf;
+	ssize_t n;
+
+	while (0 < size) {
+		n = write(fd, p, size);
+		if (n <= 0)
+			return -1;
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int reply_error(int fd, int code)
+{
+	char line[64];
+	snprintf(line, sizeof(line), "ERR %d\n", code);
+	return write_all(fd, line, strlen(line));
+}
+
+/* Answer one request line; returns nonzero if the connection broke. */
+static int request(int fd, char *line, char **buffer)
+{
+	int ret, size, n;
+	intmax_t offset;
+	char reply[64], *path, *p;
+	struct file *f;
+
+	if (strncmp(line, "OPEN ", 5) == 0) {
+		if( (f = file_acquire(line + 5, &ret)) == NULL)
+			return reply_error(fd, ret);
+		snprintf(reply, sizeof(reply), "OK %jd %jd\n",
+			(intmax_t)seekgzip_unpacked_length(f->sz),
+			(intmax_t)seekgzip_packed_length(f->sz));
+		file_release(f);
+		return write_all(fd, reply, strlen(reply));
+
+	} else if (strncmp(line, "READ ", 5) == 0) {
+		if (sscanf(line + 5, "%jd %d %n", &offset, &size, &n) != 2 ||
+			offset < 0 || size < 0 || SEEKGZIPD_MAX_READ < size)
+			return reply_error(fd, SEEKGZIP_ERROR);
+		path = line + 5 + n;
+		if( (f = file_acquire(path, &ret)) == NULL)
+			return reply_error(fd, ret);
+		if( (p = (char*)realloc(*buffer, size + 1)) == NULL){
+			file_release(f);
+			reply_error(fd, SEEKGZIP_OUTOFMEMORY);
+			return -1;
+		}
+		*buffer = p;
+		n = seekgzip_pread(f->sz, p, size, (off_t)offset);
+		file_release(f);
+		if (n < 0)
+			return reply_error(fd, n);
+		snprintf(reply, sizeof(reply), "OK %d\n", n);
+		if ((ret = write_all(fd, reply, strlen(reply))) != 0)
+			return ret;
+		return write_all(fd, p, n);
+	}
+	return reply_error(fd, SEEKGZIP_ERROR);
+}
+
+/* Read what the client has sent and answer the complete requests in it;
+   returns nonzero when the connection is to be closed. */
+static int serve(struct conn *c, char **buffer)
+{
+	ssize_t n;
+	char *eol;
+
+	n = read(c->fd, c->line + c->len, sizeof(c->line) - 1 - c->len);
+	if (n <= 0)
+		return -1;
+	c->len += n;
+
+	while ((eol = (char*)memchr(c->line, '\n', c->len)) != NULL) {
+		*eol = 0;
+		if (request(c->fd, c->line, buffer) != 0)
+			return -1;
+		c->len -= eol + 1 - c->line;
+		memmove(c->line, eol + 1, c->len);
+	}
+	if (c->len == sizeof(c->line) - 1) {
+		reply_error(c->fd, SEEKGZIP_ERROR);
+		return -1;
+	}
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	int ret;
+	ssize_t n;
+	char *buffer = NULL, byte = 0;
+	struct conn *c;
+
+	for (;;) {
+		pthread_mutex_lock(&queue.mutex);
+		while (queue.head == NULL)
+			pthread_cond_wait(&queue.cond, &queue.mutex);
+		c = queue.head;
+		if ((queue.head = c->ready) == NULL)
+			queue.tail = NULL;
+		pthread_mutex_unlock(&queue.mutex);
+
+		ret = serve(c, &buffer);
+
+		pthread_mutex_lock(&conns_mutex);
+		c->busy = 0;
+		c->closed = ret != 0;
+		pthread_mutex_unlock(&conns_mutex);
+		// A full pipe already has a wake-up pending.
+		do {
+			n = write(wake[1], &byte, 1);
+		} while (n < 0 && errno == EINTR);
+	}
+	return NULL;
+}
+
+static void usage(const char *argv0)
+{
+	printf("This daemon serves range reads of gzip files over a Unix domain socket.\n");
+	printf("USAGE:\n");
+	printf("	%s [-s SOCKET] [-t THREADS] [-c MIB] [-n FILES] [-w SECONDS]\n", argv0);
+	printf("		-s SOCKET   socket path (default: $SEEKGZIPD_SOCKET or %s)\n", SEEKGZIPD_SOCKET);
+	printf("		-t THREADS  number of worker threads (default: %d)\n", NUM_THREADS);
+	printf("		-c MIB      decompressed-span cache per file (default: %d)\n", CACHE_SIZE);
+	printf("		-n FILES    number of files kept open (default: %d)\n", MAX_FILES);
+	printf("		-w SECONDS  time a reply may wait for a client (default: %d)\n", SEND_TIMEOUT);
+}
+
+/* Queue a connection with input for the workers. */
+static void dispatch(struct conn *c)
+{
+	pthread_mutex_lock(&queue.mutex);
+	c->ready = NULL;
+	if (queue.tail != NULL)
+		queue.tail->ready = c;
+	else
+		queue.head = c;
+	queue.tail = c;
+	pthread_cond_signal(&queue.cond);
+	pthread_mutex_unlock(&queue.mutex);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, n, fd, lfd, nthreads = NUM_THREADS;
+	size_t size = 0, nconns = 0;
+	const char *socket_path = getenv("SEEKGZIPD_SOCKET");
+	char buffer[64];
+	struct sockaddr_un addr;
+	struct timeval tv;
+	struct pollfd *pfds = NULL, *pp;
+	struct conn **owners = NULL, **pc, *c;
+	pthread_t thread;
+
+	for (i = 1;i < argc;++i) {
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			socket_path = argv[++i];
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			cache_size = (size_t)strtoull(argv[++i], NULL, 10) << 20;
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			max_files = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			send_timeout = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (socket_path == NULL)
+		socket_path = SEEKGZIPD_SOCKET;
+	if (nthreads <= 0)
+		nthreads = 1;
+	if (max_files <= 0)
+		max_files = 1;
+	if (send_timeout <= 0)
+		send_timeout = 1;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	unlink(socket_path);
+	if ((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+		bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+		listen(lfd, 128) == -1) {
+		fprintf(stderr, "ERROR: Failed to listen on %s: %s\n", socket_path, strerror(errno));
+		return 1;
+	}
+	if (pipe(wake) != 0) {
+		fprintf(stderr, "ERROR: pipe: %s\n", strerror(errno));
+		return 1;
+	}
+	fcntl(wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(wake[1], F_SETFL, O_NONBLOCK);
+
+	for (i = 0;i < nthreads;++i) {
+		if (pthread_create(&thread, NULL, worker, NULL) != 0) {
+			fprintf(stderr, "ERROR: Failed to start a worker thread.\n");
+			return 1;
+		}
+		pthread_detach(thread);
+	}
+
+	for (;;) {
+		// Watch the listener, the wake-up pipe and every idle connection.
+		if (size < nconns + 2) {
+			size = (nconns + 2) * 2;
+			if( (pp = (struct pollfd*)realloc(pfds, sizeof(*pfds) * size)) != NULL)
+				pfds = pp;
+			if( (pc = (struct conn**)realloc(owners, sizeof(*owners) * size)) != NULL)
+				owners = pc;
+			if (pp == NULL || pc == NULL) {
+				fprintf(stderr, "ERROR: Out of memory.\n");
+				return 1;
+			}
+		}
+		pthread_mutex_lock(&conns_mutex);
+		n = 2;
+		for (pc = &conns; (c = *pc) != NULL; ) {
+			if (c->closed) {
+				*pc = c->next;
+				close(c->fd);
+				free(c);
+				nconns--;
+				continue;
+			}
+			if (!c->busy) {
+				pfds[n].fd = c->fd;
+				pfds[n].events = POLLIN;
+				owners[n++] = c;
+			}
+			pc = &c->next;
+		}
+		pthread_mutex_unlock(&conns_mutex);
+		pfds[0].fd = lfd;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = wake[0];
+		pfds[1].events = POLLIN;
+
+		if (poll(pfds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "ERROR: poll: %s\n", strerror(errno));
+			break;
+		}
+		if (pfds[1].revents)
+			while (read(wake[0], buffer, sizeof(buffer)) > 0)
+				;
+
+		for (i = 2;i < n;++i) {
+			if (pfds[i].revents) {
+				pthread_mutex_lock(&conns_mutex);
+				owners[i]->busy = 1;
+				pthread_mutex_unlock(&conns_mutex);
+				dispatch(owners[i]);
+			}
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			if( (fd = accept(lfd, NULL, NULL)) == -1){
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				fprintf(stderr, "ERROR: accept: %s\n", strerror(errno));
+				break;
+			}
+			if( (c = (struct conn*)calloc(1, sizeof(*c))) == NULL){
+				close(fd);
+				continue;
+			}
+			// A worker's write fails instead of waiting for a stalled client.
+			tv.tv_sec = send_timeout;
+			tv.tv_usec = 0;
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+			c->fd = fd;
+			pthread_mutex_lock(&conns_mutex);
+			c->next = conns;
+			conns = c;
+			pthread_mutex_unlock(&conns_mutex);
+			nconns++;
+		}
+	}
+
+	close(lfd);
+	unlink(socket_path);
+	return 1;
+}
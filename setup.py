@@ -16,10 +16,13 @@ seekgzip_module = Extension(
     '_seekgzip',
     sources = [
         'seekgzip.c',
+        'seekgzip_source.c',
+        'seekgzip_set.c',
+        'seekgzip_async.c',
         'export_cpp.cpp',
         'export_python.cpp',
         ],
-    libraries=['z'],
+    libraries=['z', 'pthread'],
     extra_link_args=['-shared'],
     language='c++',
     )
@@ -0,0 +1,122 @@
+/*
+ * async FILE.gz FILE
+ *
+ * Reads submitted to an async queue must complete through the descriptor
+ * and the callbacks with the bytes of FILE; a full queue must refuse more
+ * with SEEKGZIP_BUSY, and closing the queue must run the callbacks left.
+ */
+
+#include <stdint.h>
+#include <poll.h>
+#include "seekgzip.h"
+#include "util.h"
+
+#define DEPTH 8
+#define SIZE 100000
+
+struct read {
+	off_t offset;
+	int result;
+	int called;
+	char buffer[SIZE];
+};
+
+static void on_read(void *instance, void *buffer, int result)
+{
+	struct read *r = (struct read*)instance;
+
+	if (buffer != r->buffer)
+		FAIL("callback for %jd got another buffer", (intmax_t)r->offset);
+	r->result = result;
+	r->called++;
+}
+
+static void submit(seekgzip_async_t *aq, struct read *r, off_t offset)
+{
+	int ret;
+
+	r->offset = offset;
+	r->result = -1;
+	r->called = 0;
+	if ((ret = seekgzip_async_submit(aq, r->buffer, SIZE, offset, on_read, r)) != SEEKGZIP_SUCCESS)
+		FAIL("submit at %jd: %d", (intmax_t)offset, ret);
+}
+
+/* Every read completed once with the bytes of the file, cut at its end. */
+static void check(const struct read *reads, int n, const char *ref, long total)
+{
+	int i, expected;
+
+	for (i = 0;i < n;++i) {
+		expected = reads[i].offset + SIZE <= total ? SIZE : (int)(total - reads[i].offset);
+		if (reads[i].called != 1)
+			FAIL("callback for %jd ran %d times", (intmax_t)reads[i].offset, reads[i].called);
+		if (reads[i].result != expected)
+			FAIL("read at %jd returned %d", (intmax_t)reads[i].offset, reads[i].result);
+		if (memcmp(reads[i].buffer, ref + reads[i].offset, expected) != 0)
+			FAIL("wrong data at %jd", (intmax_t)reads[i].offset);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i, n;
+	long total;
+	char *ref = load_file(argv[2], &total);
+	struct read *reads;
+	struct pollfd pfd;
+	seekgzip_t *sz;
+	seekgzip_async_t *aq;
+
+	sz = seekgzip_open(argv[1], 0);
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("open %s: %d", argv[1], seekgzip_error(sz));
+	aq = seekgzip_async_open(sz, 2, DEPTH);
+	if (seekgzip_async_error(aq) != SEEKGZIP_SUCCESS)
+		FAIL("async open: %d", seekgzip_async_error(aq));
+	if ((reads = (struct read*)malloc(sizeof(struct read) * DEPTH)) == NULL)
+		FAIL("out of memory");
+
+	// Fill the queue across the file, the last read running past its end.
+	for (i = 0;i < DEPTH - 1;++i)
+		submit(aq, &reads[i], (total / DEPTH) * i);
+	submit(aq, &reads[i], total - SIZE / 2);
+	if (seekgzip_async_submit(aq, reads[0].buffer, SIZE, 0, on_read, &reads[0]) != SEEKGZIP_BUSY)
+		FAIL("a full queue took another request");
+
+	// Wait on the descriptor as an event loop would.
+	for (n = 0;n < DEPTH;) {
+		pfd.fd = seekgzip_async_fd(aq);
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 30000) != 1)
+			FAIL("no completion after %d of %d reads", n, DEPTH);
+		n += seekgzip_async_poll(aq, 0);
+	}
+	if (seekgzip_async_poll(aq, 0) != 0)
+		FAIL("more completions than requests");
+	check(reads, DEPTH, ref, total);
+
+	// The queue takes requests again; one at a time through the wait call.
+	for (i = 0;i < DEPTH;++i)
+		submit(aq, &reads[i], (total / DEPTH) * i + total / (2 * DEPTH));
+	for (n = 0;n < DEPTH;) {
+		i = seekgzip_async_wait(aq, 1);
+		if (i != 1)
+			FAIL("wait ran %d callbacks", i);
+		n += i;
+	}
+	if (seekgzip_async_wait(aq, 0) != 0)
+		FAIL("wait with nothing in flight");
+	check(reads, DEPTH, ref, total);
+
+	// Closing serves the requests still queued.
+	for (i = 0;i < DEPTH;++i)
+		submit(aq, &reads[i], (total / DEPTH) * i + 12345);
+	seekgzip_async_close(aq);
+	check(reads, DEPTH, ref, total);
+
+	seekgzip_close(sz);
+	free(reads);
+	free(ref);
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * checkpoints FILE.gz FILE
+ *
+ * Reads concentrated on one span, with SEEKGZIP_CHECKPOINTS, must keep
+ * returning the bytes of FILE before and after the span gets checkpoints.
+ * With SEEKGZIP_SAVE_CHECKPOINTS the index file grows by the new points
+ * when the handle is closed, and reads through it stay correct.  The same
+ * holds for verified reads, which check the pieces between checkpoints.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "seekgzip.h"
+#include "util.h"
+
+#define READ_SIZE 5000
+
+static long total;
+static char *ref;
+
+/* Read at pseudo-random offsets in [begin, end), across its ends too. */
+static void read_range(seekgzip_t *sz, off_t begin, off_t end, int count)
+{
+	int i, n;
+	char buffer[READ_SIZE];
+	off_t offset;
+	unsigned seed = 1;
+
+	for (i = 0;i < count;++i) {
+		offset = begin - READ_SIZE / 2 + (off_t)(rand_r(&seed) % (end - begin + READ_SIZE));
+		if (offset < 0 || total - READ_SIZE < offset)
+			continue;
+		if ((n = seekgzip_pread(sz, buffer, READ_SIZE, offset)) != READ_SIZE)
+			FAIL("pread at %jd returned %d", (intmax_t)offset, n);
+		if (memcmp(buffer, ref + offset, READ_SIZE) != 0)
+			FAIL("wrong data at %jd", (intmax_t)offset);
+	}
+}
+
+static off_t index_size(const char *path)
+{
+	char index[4096];
+	struct stat st;
+
+	snprintf(index, sizeof(index), "%s.idx", path);
+	if (stat(index, &st) != 0)
+		FAIL("no index %s", index);
+	return st.st_size;
+}
+
+int main(int argc, char *argv[])
+{
+	char index[4096];
+	off_t before;
+	seekgzip_t *sz;
+
+	ref = load_file(argv[2], &total);
+
+	sz = seekgzip_open(argv[1], 0);
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("open %s: %d", argv[1], seekgzip_error(sz));
+	seekgzip_close(sz);
+	before = index_size(argv[1]);
+
+	sz = seekgzip_open(argv[1], SEEKGZIP_CHECKPOINTS | SEEKGZIP_SAVE_CHECKPOINTS);
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("open %s with checkpoints: %d", argv[1], seekgzip_error(sz));
+	read_range(sz, total / 2, total / 2 + 300000, 100);
+	read_range(sz, 0, total, 50);
+	seekgzip_close(sz);
+	if (index_size(argv[1]) <= before)
+		FAIL("the checkpoints were not saved");
+
+	sz = seekgzip_open(argv[1], 0);
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("reopen %s: %d", argv[1], seekgzip_error(sz));
+	read_range(sz, total / 2, total / 2 + 300000, 100);
+	read_range(sz, 0, total, 50);
+	seekgzip_close(sz);
+
+	// Start over from a plain index, reading with verification.
+	snprintf(index, sizeof(index), "%s.idx", argv[1]);
+	unlink(index);
+	sz = seekgzip_open(argv[1], 0);
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("rebuild %s: %d", argv[1], seekgzip_error(sz));
+	seekgzip_close(sz);
+	before = index_size(argv[1]);
+
+	sz = seekgzip_open(argv[1], SEEKGZIP_VERIFY | SEEKGZIP_CHECKPOINTS | SEEKGZIP_SAVE_CHECKPOINTS);
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("open %s verified: %d", argv[1], seekgzip_error(sz));
+	read_range(sz, total / 2, total / 2 + 300000, 100);
+	read_range(sz, 0, total, 50);
+	seekgzip_close(sz);
+	if (index_size(argv[1]) <= before)
+		FAIL("verified reads added no checkpoints");
+
+	sz = seekgzip_open(argv[1], SEEKGZIP_VERIFY);
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("reopen %s verified: %d", argv[1], seekgzip_error(sz));
+	read_range(sz, total / 2, total / 2 + 300000, 100);
+	seekgzip_close(sz);
+
+	free(ref);
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * daemon SOCKET FILE.gz FILE OTHER.gz
+ *
+ * Against a seekgzipd started with one worker, one open file and a short
+ * send timeout: clients that connected and went idle, or that stopped
+ * reading a reply, must not keep another client from being served, and
+ * reads alternating between two files (so that each evicts the other)
+ * must return the bytes of FILE.  Against a fake daemon that fails the
+ * second part of a long read, the client must return the first part and
+ * report the error on the next call.
+ */
+
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "seekgzip.h"
+#include "seekgzip_client.h"
+#include "util.h"
+
+static seekgzip_client_t *open_client(const char *socket, const char *path)
+{
+	seekgzip_client_t *zc = seekgzip_client_open(socket, path);
+
+	if (seekgzip_client_error(zc) != SEEKGZIP_SUCCESS)
+		FAIL("open %s: %d", path, seekgzip_client_error(zc));
+	return zc;
+}
+
+static int connect_to(const char *socket_path)
+{
+	int fd;
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+		connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+		FAIL("connect to %s", socket_path);
+	return fd;
+}
+
+/* Ask for a large range and never read the reply. */
+static int stall(const char *socket_path, const char *path)
+{
+	char line[PATH_MAX + 64], *full = realpath(path, NULL);
+	int fd = connect_to(socket_path);
+
+	snprintf(line, sizeof(line), "READ 0 %d %s\n", SEEKGZIPD_MAX_READ, full);
+	if (write(fd, line, strlen(line)) != (ssize_t)strlen(line))
+		FAIL("stalled request");
+	free(full);
+	return fd;
+}
+
+/* Serve one connection: OPEN succeeds, the first READ is answered in full
+   and every later one with an error. */
+static void fake_daemon(int lfd)
+{
+	int fd, size, reads = 0;
+	char line[PATH_MAX + 64], *data;
+	FILE *in;
+
+	if ((fd = accept(lfd, NULL, NULL)) == -1 || (in = fdopen(fd, "r")) == NULL)
+		_exit(1);
+	while (fgets(line, sizeof(line), in) != NULL) {
+		if (strncmp(line, "OPEN ", 5) == 0) {
+			snprintf(line, sizeof(line), "OK %d 1000\n", 2 * SEEKGZIPD_MAX_READ);
+		} else if (reads++ == 0 && sscanf(line, "READ %*d %d", &size) == 1 &&
+			(data = (char*)calloc(1, size)) != NULL) {
+			snprintf(line, sizeof(line), "OK %d\n", size);
+			if (write(fd, line, strlen(line)) < 0 || write(fd, data, size) != size)
+				_exit(1);
+			free(data);
+			continue;
+		} else {
+			snprintf(line, sizeof(line), "ERR %d\n", SEEKGZIP_DATAERROR);
+		}
+		if (write(fd, line, strlen(line)) < 0)
+			_exit(1);
+	}
+	_exit(0);
+}
+
+/* A read that fails half way returns what arrived; the next call fails. */
+static void partial_error(const char *socket_path, const char *path)
+{
+	int n, lfd, status;
+	char *fake, *buffer;
+	struct sockaddr_un addr;
+	seekgzip_client_t *zc;
+	pid_t pid;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.fake", socket_path);
+	fake = addr.sun_path;
+	unlink(fake);
+	if ((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+		bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(lfd, 1) == -1)
+		FAIL("listen on %s", fake);
+	if ((pid = fork()) == 0)
+		fake_daemon(lfd);
+	close(lfd);
+
+	zc = open_client(fake, path);
+	if ((buffer = (char*)malloc(SEEKGZIPD_MAX_READ + 1000)) == NULL)
+		FAIL("out of memory");
+	if ((n = seekgzip_client_read(zc, buffer, SEEKGZIPD_MAX_READ + 1000)) != SEEKGZIPD_MAX_READ)
+		FAIL("a read failing half way returned %d", n);
+	if (seekgzip_client_tell(zc) != SEEKGZIPD_MAX_READ)
+		FAIL("tell after a partial read");
+	if ((n = seekgzip_client_read(zc, buffer, 1000)) != SEEKGZIP_DATAERROR)
+		FAIL("the read after a partial one returned %d", n);
+	seekgzip_client_close(zc);
+	free(buffer);
+	waitpid(pid, &status, 0);
+	unlink(fake);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, n, stalled;
+	long total;
+	off_t offset;
+	char buffer[4096], *ref = load_file(argv[3], &total);
+	seekgzip_client_t *idle1, *idle2, *zc, *other;
+
+	// A daemon that waits on an idle client never answers; give up.
+	alarm(30);
+
+	idle1 = open_client(argv[1], argv[2]);
+	idle2 = open_client(argv[1], argv[2]);
+	zc = open_client(argv[1], argv[2]);
+	other = open_client(argv[1], argv[4]);
+
+	// Let the only worker get stuck on a client that does not read.
+	stalled = stall(argv[1], argv[2]);
+	sleep(1);
+
+	for (i = 0;i < 16;++i) {
+		offset = (off_t)(total / 16) * i + i;
+		seekgzip_client_seek(zc, offset);
+		if ((n = seekgzip_client_read(zc, buffer, sizeof(buffer))) <= 0)
+			FAIL("read at %jd returned %d", (intmax_t)offset, n);
+		if (memcmp(buffer, ref + offset, n) != 0)
+			FAIL("wrong data at %jd", (intmax_t)offset);
+
+		seekgzip_client_seek(other, offset);
+		if ((n = seekgzip_client_read(other, buffer, sizeof(buffer))) <= 0)
+			FAIL("read of the other file at %jd returned %d", (intmax_t)offset, n);
+	}
+
+	seekgzip_client_close(other);
+	seekgzip_client_close(zc);
+	seekgzip_client_close(idle2);
+	seekgzip_client_close(idle1);
+	close(stalled);
+
+	partial_error(argv[1], argv[2]);
+	free(ref);
+	return 0;
+}
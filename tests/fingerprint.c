@@ -0,0 +1,92 @@
+/*
+ * fingerprint FILE.gz
+ *
+ * The index of FILE.gz (built beside it by this program) must survive a new
+ * modification time of unchanged data, and must be rebuilt when bytes of
+ * FILE.gz change at the same size, with or without SEEKGZIP_STRICT.
+ */
+
+#include <time.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include "seekgzip.h"
+#include "util.h"
+
+static char *path_index;
+
+static void set_mtime(const char *path, time_t mtime)
+{
+	struct utimbuf times;
+
+	times.actime = times.modtime = mtime;
+	if (utime(path, &times) != 0)
+		FAIL("utime %s", path);
+}
+
+/* Open and close path; returns the resulting index file. */
+static char *open_index(const char *path, int flags, long *size)
+{
+	seekgzip_t *sz = seekgzip_open(path, flags);
+
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("open %s: %d", path, seekgzip_error(sz));
+	seekgzip_close(sz);
+	return load_file(path_index, size);
+}
+
+/* Overwrite the byte at offset, in the gzip header, with a new value. */
+static void patch(const char *path, long offset)
+{
+	int c;
+	FILE *fp = fopen(path, "r+b");
+
+	if (fp == NULL || fseek(fp, offset, SEEK_SET) != 0 || (c = fgetc(fp)) == EOF)
+		FAIL("patch %s", path);
+	fseek(fp, offset, SEEK_SET);
+	fputc(c ^ 0x55, fp);
+	fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+	long size, size2;
+	struct stat st;
+	char *index, *index2;
+
+	if ((path_index = (char*)malloc(strlen(argv[1]) + 5)) == NULL)
+		FAIL("out of memory");
+	sprintf(path_index, "%s.idx", argv[1]);
+	remove(path_index);
+	index = open_index(argv[1], 0, &size);
+
+	// A copy without preserved times keeps its index.
+	set_mtime(argv[1], time(NULL) - 1000);
+	index2 = open_index(argv[1], 0, &size2);
+	if (size != size2 || memcmp(index, index2, size) != 0)
+		FAIL("index rebuilt for unchanged data");
+	free(index2);
+
+	// The MTIME field of the gzip header changes neither size nor content.
+	patch(argv[1], 4);
+	set_mtime(argv[1], time(NULL) - 2000);
+	index2 = open_index(argv[1], 0, &size2);
+	if (size == size2 && memcmp(index, index2, size) == 0)
+		FAIL("index kept for changed data");
+	free(index);
+	index = index2;
+	size = size2;
+
+	// A change behind matching modification times needs SEEKGZIP_STRICT.
+	if (stat(argv[1], &st) != 0)
+		FAIL("stat %s", argv[1]);
+	patch(argv[1], 5);
+	set_mtime(argv[1], st.st_mtime);
+	index2 = open_index(argv[1], SEEKGZIP_STRICT, &size2);
+	if (size == size2 && memcmp(index, index2, size) == 0)
+		FAIL("index kept for changed data with SEEKGZIP_STRICT");
+
+	free(index2);
+	free(index);
+	free(path_index);
+	return 0;
+}
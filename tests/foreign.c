@@ -0,0 +1,98 @@
+/*
+ * foreign FILE.gz BGZF.gz FILE
+ *
+ * Both gzip files hold FILE, the second as BGZF blocks.  An index exported
+ * as GZIDX (for FILE.gz) or .gzi (for BGZF.gz) must be picked up by the
+ * first open when it is the only index beside the data, and must convert
+ * back with seekgzip_import(); reads through the imported index must
+ * return the bytes of FILE.  Verifying a file with an imported index must
+ * record span CRCs, so that verified reads can use the index.
+ */
+
+#include <stdint.h>
+#include "seekgzip.h"
+#include "util.h"
+
+#define READ_SIZE 5000
+
+static long total;
+static char *ref;
+
+static seekgzip_t *open_file(const char *path, int flags)
+{
+	seekgzip_t *sz = seekgzip_open(path, flags);
+
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("open %s: %d", path, seekgzip_error(sz));
+	return sz;
+}
+
+static void read_some(const char *path, int flags)
+{
+	int i, n;
+	char buffer[READ_SIZE];
+	off_t offset;
+	seekgzip_t *sz = open_file(path, flags);
+
+	for (i = 0;i < 32;++i) {
+		offset = (off_t)(total - READ_SIZE) / 31 * i;
+		if ((n = seekgzip_pread(sz, buffer, READ_SIZE, offset)) != READ_SIZE)
+			FAIL("%s: pread at %jd returned %d", path, (intmax_t)offset, n);
+		if (memcmp(buffer, ref + offset, READ_SIZE) != 0)
+			FAIL("%s: wrong data at %jd", path, (intmax_t)offset);
+	}
+	seekgzip_close(sz);
+}
+
+static void round_trip(const char *path, int format, const char *suffix)
+{
+	int ret;
+	long before, after;
+	char index[4096], exported[4096], *data;
+	FILE *fp;
+	seekgzip_t *sz;
+
+	snprintf(index, sizeof(index), "%s.idx", path);
+	snprintf(exported, sizeof(exported), "%s%s", path, suffix);
+
+	sz = open_file(path, 0);
+	if ((ret = seekgzip_index_export(sz, exported, format)) != SEEKGZIP_SUCCESS)
+		FAIL("export %s: %d", exported, ret);
+	seekgzip_close(sz);
+
+	// The first open imports the index beside the data and saves it.
+	remove(index);
+	read_some(path, 0);
+	if ((fp = fopen(index, "rb")) == NULL)
+		FAIL("no index saved after importing %s", exported);
+	fclose(fp);
+
+	// Verification records span CRCs in the imported index.
+	data = load_file(index, &before);
+	free(data);
+	sz = open_file(path, 0);
+	if ((ret = seekgzip_verify(sz, 2, NULL, NULL)) != SEEKGZIP_SUCCESS)
+		FAIL("verify %s: %d", path, ret);
+	seekgzip_close(sz);
+	data = load_file(index, &after);
+	free(data);
+	if (after <= before)
+		FAIL("verify did not record CRCs in the index of %s", path);
+	read_some(path, SEEKGZIP_VERIFY);
+
+	// seekgzip_import() converts the exported index explicitly.
+	remove(index);
+	if ((ret = seekgzip_import(path, exported)) != SEEKGZIP_SUCCESS)
+		FAIL("import %s: %d", exported, ret);
+	read_some(path, 0);
+	remove(exported);
+}
+
+int main(int argc, char *argv[])
+{
+	ref = load_file(argv[3], &total);
+	round_trip(argv[1], SEEKGZIP_FORMAT_GZIDX, ".gzidx");
+	round_trip(argv[2], SEEKGZIP_FORMAT_GZI, ".gzi");
+	free(ref);
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * http URL FILE.gz FILE
+ *
+ * URL serves the directory of FILE.gz through tests/httpd.py.  Reads of the
+ * HTTP source from several threads must wait on the server in parallel,
+ * and concurrent reads of FILE.gz by URL must return the bytes of FILE.
+ * A reply with a range other than the one requested must fail the read.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "seekgzip.h"
+#include "util.h"
+
+#define NUM_THREADS 4
+#define READ_SIZE 10000
+
+static char *url, *ref, *packed;
+static long total, packed_size;
+static seekgzip_source_t *src;
+static seekgzip_t *sz;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* One read of the slow source, far from the reads of the other threads. */
+static void *read_source(void *arg)
+{
+	char buffer[4096];
+	off_t offset = packed_size / NUM_THREADS * (intptr_t)arg + 100;
+
+	if (src->read_at(src, buffer, sizeof(buffer), offset) != sizeof(buffer))
+		FAIL("source read at %jd", (intmax_t)offset);
+	if (memcmp(buffer, packed + offset, sizeof(buffer)) != 0)
+		FAIL("wrong source data at %jd", (intmax_t)offset);
+	return NULL;
+}
+
+static void *read_gzip(void *arg)
+{
+	int i, n;
+	char buffer[READ_SIZE];
+	unsigned seed = (unsigned)(intptr_t)arg;
+	off_t offset;
+
+	for (i = 0;i < 8;++i) {
+		offset = (off_t)(rand_r(&seed) % (total - READ_SIZE));
+		if ((n = seekgzip_pread(sz, buffer, READ_SIZE, offset)) != READ_SIZE)
+			FAIL("pread at %jd returned %d", (intmax_t)offset, n);
+		if (memcmp(buffer, ref + offset, READ_SIZE) != 0)
+			FAIL("wrong data at %jd", (intmax_t)offset);
+	}
+	return NULL;
+}
+
+static void run(void *(*func)(void *))
+{
+	intptr_t i;
+	pthread_t threads[NUM_THREADS];
+
+	for (i = 0;i < NUM_THREADS;++i)
+		pthread_create(&threads[i], NULL, func, (void*)i);
+	for (i = 0;i < NUM_THREADS;++i)
+		pthread_join(threads[i], NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	double start;
+	char *name = strrchr(argv[2], '/') != NULL ? strrchr(argv[2], '/') + 1 : argv[2];
+
+	packed = load_file(argv[2], &packed_size);
+	ref = load_file(argv[3], &total);
+	if ((url = (char*)malloc(strlen(argv[1]) + strlen(name) + 16)) == NULL)
+		FAIL("out of memory");
+
+	// Every request to /slow/ takes a second; serialized reads take longer.
+	sprintf(url, "%s/slow/%s", argv[1], name);
+	if ((src = seekgzip_source_http(url)) == NULL)
+		FAIL("cannot open %s", url);
+	start = now();
+	run(read_source);
+	if (now() - start >= NUM_THREADS - 1)
+		FAIL("%d concurrent reads took %.1f s", NUM_THREADS, now() - start);
+	src->close(src);
+
+	// The server answers with the range one byte later.
+	sprintf(url, "%s/shifted/%s", argv[1], name);
+	if ((src = seekgzip_source_http(url)) == NULL)
+		FAIL("cannot open %s", url);
+	if (src->read_at(src, packed, 4096, packed_size / 2) >= 0)
+		FAIL("a shifted range was accepted");
+	src->close(src);
+
+	sprintf(url, "%s/%s", argv[1], name);
+	sz = seekgzip_open(url, 0);
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("open %s: %d", url, seekgzip_error(sz));
+	run(read_gzip);
+	seekgzip_close(sz);
+
+	free(url);
+	free(ref);
+	free(packed);
+	return 0;
+}
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+#
+# httpd.py DIR PORTFILE
+#
+# Serve the files in DIR over HTTP/1.1 with Range requests on a free local
+# port, which is written to PORTFILE.  Requests for /slow/NAME serve NAME
+# after a delay of one second; requests for /shifted/NAME answer ranges that
+# do not start at 0 with the range one byte later, as a broken proxy might.
+
+import email.utils
+import http.server
+import os
+import re
+import sys
+import time
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def do_GET(self):
+        path, shift = self.path, 0
+        if path.startswith('/slow/'):
+            time.sleep(1)
+            path = path[5:]
+        elif path.startswith('/shifted/'):
+            shift = 1
+            path = path[8:]
+        name = os.path.join(sys.argv[1], os.path.basename(path))
+        if not os.path.isfile(name):
+            self.send_error(404)
+            return
+        with open(name, 'rb') as f:
+            data = f.read()
+        size = len(data)
+        status, body = 200, data
+        m = re.match(r'bytes=(\d+)-(\d*)$', self.headers.get('Range', ''))
+        if m:
+            begin = int(m.group(1))
+            end = int(m.group(2)) + 1 if m.group(2) else size
+            if begin != 0:
+                begin, end = begin + shift, end + shift
+            if size <= begin:
+                self.send_response(416)
+                self.send_header('Content-Range', 'bytes */%d' % size)
+                self.send_header('Content-Length', '0')
+                self.end_headers()
+                return
+            status, body = 206, data[begin:min(end, size)]
+        self.send_response(status)
+        if status == 206:
+            self.send_header('Content-Range', 'bytes %d-%d/%d' % (begin, begin + len(body) - 1, size))
+        self.send_header('Content-Length', str(len(body)))
+        self.send_header('Last-Modified', email.utils.formatdate(os.path.getmtime(name), usegmt=True))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        pass
+
+
+class Server(http.server.ThreadingHTTPServer):
+    def handle_error(self, request, client_address):
+        # Clients drop connections whose replies they reject.
+        if not isinstance(sys.exc_info()[1], ConnectionError):
+            super().handle_error(request, client_address)
+
+
+server = Server(('127.0.0.1', 0), Handler)
+with open(sys.argv[2] + '.tmp', 'w') as f:
+    f.write('%d\n' % server.server_address[1])
+os.rename(sys.argv[2] + '.tmp', sys.argv[2])
+server.serve_forever()
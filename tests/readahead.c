@@ -0,0 +1,42 @@
+/*
+ * readahead FILE.gz FILE
+ *
+ * Sequential reads with SEEKGZIP_READAHEAD, in uneven pieces and after
+ * seeks, must return the same bytes as the uncompressed FILE.
+ */
+
+#include "seekgzip.h"
+#include "util.h"
+
+int main(int argc, char *argv[])
+{
+	int i, n, size;
+	long total;
+	off_t offset;
+	char *ref = load_file(argv[2], &total), *buffer;
+	seekgzip_t *sz = seekgzip_open(argv[1], SEEKGZIP_READAHEAD);
+
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("open %s: %d", argv[1], seekgzip_error(sz));
+	if ((buffer = (char*)malloc(1 << 20)) == NULL)
+		FAIL("out of memory");
+
+	for (i = 0;i < 3;++i) {
+		offset = i * (total / 3) + 12345;
+		seekgzip_seek(sz, offset);
+		for (size = 1;offset < total;size = size * 3 % (1 << 20) + 1) {
+			if ((n = seekgzip_read(sz, buffer, size)) <= 0)
+				FAIL("read at %jd returned %d", (intmax_t)offset, n);
+			if (memcmp(buffer, ref + offset, n) != 0)
+				FAIL("wrong data at %jd", (intmax_t)offset);
+			offset += n;
+		}
+		if (seekgzip_read(sz, buffer, 1) != 0)
+			FAIL("read past the end");
+	}
+
+	seekgzip_close(sz);
+	free(buffer);
+	free(ref);
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * reindex FILE.gz FILE
+ *
+ * Re-spanning the index of FILE.gz to denser and then coarser access points
+ * must save an index that grows and shrinks accordingly, and reads through
+ * it, before and after reopening, must return the bytes of FILE.
+ */
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include "seekgzip.h"
+#include "util.h"
+
+#define READ_SIZE 5000
+
+static long total;
+static char *ref;
+
+static void read_some(seekgzip_t *sz)
+{
+	int i, n;
+	char buffer[READ_SIZE];
+	off_t offset;
+
+	for (i = 0;i < 64;++i) {
+		offset = (off_t)(total - READ_SIZE) / 63 * i;
+		if ((n = seekgzip_pread(sz, buffer, READ_SIZE, offset)) != READ_SIZE)
+			FAIL("pread at %jd returned %d", (intmax_t)offset, n);
+		if (memcmp(buffer, ref + offset, READ_SIZE) != 0)
+			FAIL("wrong data at %jd", (intmax_t)offset);
+	}
+}
+
+/* Re-span, check the reads, and return the size of the saved index. */
+static off_t reindex(const char *path, off_t span)
+{
+	int ret;
+	char index[4096];
+	struct stat st;
+	seekgzip_t *sz = seekgzip_open(path, 0);
+
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("open %s: %d", path, seekgzip_error(sz));
+	if ((ret = seekgzip_reindex(sz, span, 2)) != SEEKGZIP_SUCCESS)
+		FAIL("reindex to %jd: %d", (intmax_t)span, ret);
+	read_some(sz);
+	seekgzip_close(sz);
+
+	sz = seekgzip_open(path, 0);
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("reopen %s: %d", path, seekgzip_error(sz));
+	read_some(sz);
+	seekgzip_close(sz);
+
+	snprintf(index, sizeof(index), "%s.idx", path);
+	if (stat(index, &st) != 0)
+		FAIL("no index %s", index);
+	return st.st_size;
+}
+
+int main(int argc, char *argv[])
+{
+	off_t dense, coarse;
+
+	ref = load_file(argv[2], &total);
+	dense = reindex(argv[1], 1 << 18);
+	coarse = reindex(argv[1], 1 << 22);
+	if (dense <= coarse)
+		FAIL("the index has %jd bytes with 256 KiB spans, %jd with 4 MiB spans",
+			(intmax_t)dense, (intmax_t)coarse);
+	free(ref);
+	return 0;
+}
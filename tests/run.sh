@@ -0,0 +1,209 @@
+#!/bin/sh
+#
+# Run the tests against the binaries in the top directory; "make test"
+# builds them first.  Usage: tests/run.sh [NAME...]
+
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+SEEKGZIP="$TOP/seekgzip"
+TESTS="$TOP/tests"
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+failed=0
+
+pass() { echo "PASS: $1"; }
+fail() { echo "FAIL: $1"; failed=$((failed + 1)); }
+
+# check NAME COMMAND...: the command must succeed.
+check() {
+	name=$1; shift
+	if "$@" > "$TMP/out" 2> "$TMP/err"; then
+		pass "$name"
+	else
+		fail "$name"
+		cat "$TMP/err"
+	fi
+}
+
+# Test data: about 20 MiB of numbered lines, about 20 access points.
+seq 1 3000000 > "$TMP/data.txt"
+gzip -c "$TMP/data.txt" > "$TMP/data.gz"
+
+test_readahead() {
+	check "readahead: sequential reads" "$TESTS/readahead" "$TMP/data.gz" "$TMP/data.txt"
+}
+
+test_daemon() {
+	cp "$TMP/data.gz" "$TMP/other.gz"
+	"$TOP/seekgzipd" -s "$TMP/sock" -t 1 -n 1 -w 2 &
+	pid=$!
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		[ -S "$TMP/sock" ] && break
+		sleep 1
+	done
+	check "daemon: idle and stalled clients, file eviction, partial reads" "$TESTS/daemon" "$TMP/sock" \
+		"$TMP/data.gz" "$TMP/data.txt" "$TMP/other.gz"
+	kill $pid
+	wait $pid 2> /dev/null
+}
+
+test_http() {
+	if ! command -v python3 > /dev/null; then
+		echo "SKIP: http: no python3"
+		return
+	fi
+	"$SEEKGZIP" -b "$TMP/data.gz" > /dev/null 2>&1
+	python3 "$TESTS/httpd.py" "$TMP" "$TMP/port" &
+	pid=$!
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		[ -f "$TMP/port" ] && break
+		sleep 1
+	done
+	check "http: concurrent range reads" "$TESTS/http" \
+		"http://127.0.0.1:$(cat "$TMP/port")" "$TMP/data.gz" "$TMP/data.txt"
+	kill $pid
+	wait $pid 2> /dev/null
+}
+
+test_fingerprint() {
+	cp "$TMP/data.gz" "$TMP/fp.gz"
+	check "fingerprint: copies kept, changes rejected" "$TESTS/fingerprint" "$TMP/fp.gz"
+}
+
+test_verify() {
+	head -c 8000000 /dev/urandom | gzip -c > "$TMP/random.gz"
+	check "verify: span CRC mismatches" "$TESTS/verify" "$TMP/random.gz"
+}
+
+test_set() {
+	head -n 1000000 "$TMP/data.txt" | gzip -c > "$TMP/set1.gz"
+	sed -n '1000001,2000000p' "$TMP/data.txt" | gzip -c > "$TMP/set2.gz"
+	tail -n +2000001 "$TMP/data.txt" | gzip -c > "$TMP/set3.gz"
+	check "set: reads across files" "$TESTS/set" "$TMP/data.txt" \
+		"$TMP/set1.gz" "$TMP/set2.gz" "$TMP/set3.gz"
+}
+
+test_batch() {
+	mkdir -p "$TMP/batch/sub"
+	for i in 1 2 3; do
+		head -n ${i}00000 "$TMP/data.txt" | gzip -c > "$TMP/batch/f$i.gz"
+	done
+	cp "$TMP/data.gz" "$TMP/batch/sub/g.gz"
+	tail -c +1000001 "$TMP/data.txt" | head -c 100000 > "$TMP/expected"
+
+	if "$SEEKGZIP" -b -j 2 -r "$TMP/batch" > "$TMP/out" 2>&1 &&
+		grep -q "^4 files: 4 indexed, 0 up to date, 0 failed" "$TMP/out" &&
+		[ -f "$TMP/batch/sub/g.gz.idx" ] &&
+		"$SEEKGZIP" "$TMP/batch/sub/g.gz" 1000000-1100000 | cmp -s - "$TMP/expected"; then
+		pass "batch: recursive build"
+	else
+		fail "batch: recursive build"
+		cat "$TMP/out"
+	fi
+
+	echo "not gzip" > "$TMP/batch/bad.gz"
+	ls "$TMP/batch"/*.gz | "$SEEKGZIP" -b - > "$TMP/out" 2>&1
+	if [ $? -ne 0 ] &&
+		grep -q "^4 files: 0 indexed, 3 up to date, 1 failed" "$TMP/out"; then
+		pass "batch: file list, skipping valid indexes"
+	else
+		fail "batch: file list, skipping valid indexes"
+		cat "$TMP/out"
+	fi
+
+	# A copy with a fresh modification time keeps its index by fingerprint.
+	cp "$TMP/batch/sub/g.gz" "$TMP/batch/copy.gz"
+	cp "$TMP/batch/sub/g.gz.idx" "$TMP/batch/copy.gz.idx"
+	touch -d 2001-01-01 "$TMP/batch/copy.gz"
+	cp "$TMP/batch/copy.gz.idx" "$TMP/idx.before"
+	if "$SEEKGZIP" -b "$TMP/batch/copy.gz" > "$TMP/out" 2>&1 &&
+		grep -q "^1 files: 0 indexed, 1 up to date, 0 failed" "$TMP/out" &&
+		cmp -s "$TMP/batch/copy.gz.idx" "$TMP/idx.before"; then
+		pass "batch: copied index kept by fingerprint"
+	else
+		fail "batch: copied index kept by fingerprint"
+		cat "$TMP/out"
+	fi
+}
+
+test_checkpoints() {
+	cp "$TMP/data.gz" "$TMP/hot.gz"
+	check "checkpoints: hot spans" "$TESTS/checkpoints" "$TMP/hot.gz" "$TMP/data.txt"
+}
+
+test_reindex() {
+	cp "$TMP/data.gz" "$TMP/respan.gz"
+	check "reindex: denser and coarser spans" "$TESTS/reindex" "$TMP/respan.gz" "$TMP/data.txt"
+}
+
+# The empty BGZF block that ends a BGZF file.
+BGZF_EOF=1f8b08040000000000ff0600424302001b0003000000000000000000
+
+test_repack() {
+	tail -c +5000001 "$TMP/data.txt" | head -c 300000 > "$TMP/expected"
+	for mode in gzip bgzf; do
+		opt=; [ $mode = bgzf ] && opt=--bgzf
+		rm -f "$TMP/packed.gz" "$TMP/packed.gz.idx"
+		if "$SEEKGZIP" repack -j 2 $opt "$TMP/data.gz" "$TMP/packed.gz" > "$TMP/out" 2>&1 &&
+			gzip -dc "$TMP/packed.gz" | cmp -s - "$TMP/data.txt" &&
+			[ -f "$TMP/packed.gz.idx" ] &&
+			"$SEEKGZIP" "$TMP/packed.gz" 5000000-5300000 | cmp -s - "$TMP/expected" &&
+			{ [ $mode = gzip ] ||
+			  [ "$(tail -c 28 "$TMP/packed.gz" | od -An -tx1 | tr -d ' \n')" = $BGZF_EOF ]; }; then
+			pass "repack: $mode members"
+		else
+			fail "repack: $mode members"
+			cat "$TMP/out"
+		fi
+	done
+}
+
+test_tar() {
+	mkdir -p "$TMP/tar/sub"
+	cp "$TMP/data.txt" "$TMP/tar/data.txt"
+	head -n 1000 "$TMP/data.txt" > "$TMP/tar/sub/small.txt"
+	: > "$TMP/tar/empty"
+	(cd "$TMP/tar" && tar -czf "$TMP/members.tar.gz" data.txt sub/small.txt empty)
+	ok=1
+	"$SEEKGZIP" tar-list "$TMP/members.tar.gz" > "$TMP/out" 2>&1 || ok=
+	for name in data.txt sub/small.txt empty; do
+		grep -q "	$name\$" "$TMP/out" || ok=
+		"$SEEKGZIP" tar-extract "$TMP/members.tar.gz" $name 2>> "$TMP/out" |
+			cmp -s - "$TMP/tar/$name" || ok=
+	done
+	"$SEEKGZIP" tar-extract "$TMP/members.tar.gz" missing > /dev/null 2>&1 && ok=
+	if [ "$ok" ]; then
+		pass "tar: list and extract members"
+	else
+		fail "tar: list and extract members"
+		cat "$TMP/out"
+	fi
+}
+
+test_sample() {
+	check "sample: lines" "$TESTS/sample" "$TMP/data.gz" "$TMP/data.txt" "
+"
+	# Records of about 2 MiB, so that whole spans hold no delimiter.
+	awk 'NR % 300000 == 0 { print; next } { printf "%s,", $0 }' "$TMP/data.txt" > "$TMP/long.txt"
+	gzip -c "$TMP/long.txt" > "$TMP/long.gz"
+	check "sample: records longer than a span" "$TESTS/sample" "$TMP/long.gz" "$TMP/long.txt" "
+"
+	check "sample: records crossing spans" "$TESTS/sample" "$TMP/data.gz" "$TMP/data.txt" "0"
+}
+
+test_foreign() {
+	cp "$TMP/data.gz" "$TMP/plain.gz"
+	"$SEEKGZIP" repack --bgzf "$TMP/data.gz" "$TMP/bgzf.gz" > /dev/null 2>&1
+	check "foreign: gzi and gzidx round trips" "$TESTS/foreign" \
+		"$TMP/plain.gz" "$TMP/bgzf.gz" "$TMP/data.txt"
+}
+
+test_async() {
+	check "async: completions through the descriptor" "$TESTS/async" "$TMP/data.gz" "$TMP/data.txt"
+}
+
+for t in ${*:-readahead daemon http fingerprint verify set batch checkpoints reindex repack tar sample foreign async}; do
+	test_$t
+done
+
+[ $failed -eq 0 ] && echo "All tests passed." || echo "$failed test(s) failed."
+[ $failed -eq 0 ]
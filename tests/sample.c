@@ -0,0 +1,97 @@
+/*
+ * sample FILE.gz FILE DELIM
+ *
+ * seekgzip_sample() must report, in file order and once each, exactly the
+ * records of FILE (terminated by the character DELIM) that contain the
+ * drawn offsets, whatever the number of threads.  The offsets are drawn
+ * here again with the same generator to compute the expected records.
+ */
+
+#include <stdint.h>
+#include "seekgzip.h"
+#include "util.h"
+
+static long total;
+static char *ref;
+static int delim;
+
+struct result {
+	off_t                  expect[20000];	/* starts of the expected records */
+	int                    n, got;
+};
+
+/* splitmix64, as in seekgzip_sample() */
+static uint64_t next_random(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static int compare_offsets(const void *x, const void *y)
+{
+	off_t a = *(const off_t*)x, b = *(const off_t*)y;
+	return (a > b) - (a < b);
+}
+
+static void callback(void *instance, off_t offset, const void *record, size_t size)
+{
+	struct result *r = (struct result*)instance;
+	off_t end;
+
+	if (r->n <= r->got || r->expect[r->got] != offset)
+		FAIL("record %d starts at %jd", r->got, (intmax_t)offset);
+	for (end = offset;end < total && ref[end] != delim;++end)
+		;
+	if (end < total)
+		end++;
+	if ((off_t)size != end - offset || memcmp(record, ref + offset, size) != 0)
+		FAIL("wrong record at %jd (%zu bytes)", (intmax_t)offset, size);
+	r->got++;
+}
+
+static void sample(seekgzip_t *sz, int k, unsigned long seed, int nthreads)
+{
+	int i, ret;
+	off_t *offsets = (off_t*)malloc(sizeof(off_t) * k), pos = 0, start = 0;
+	uint64_t state = seed;
+	static struct result r;
+
+	for (i = 0;i < k;++i)
+		offsets[i] = (off_t)(next_random(&state) % (uint64_t)total);
+	qsort(offsets, k, sizeof(off_t), compare_offsets);
+	r.n = r.got = 0;
+	for (i = 0;i < k;++i) {
+		for (;pos < offsets[i];++pos)
+			if (ref[pos] == delim)
+				start = pos + 1;
+		if (r.n == 0 || r.expect[r.n - 1] != start)
+			r.expect[r.n++] = start;
+	}
+
+	if ((ret = seekgzip_sample(sz, k, seed, delim, nthreads, callback, &r)) != SEEKGZIP_SUCCESS)
+		FAIL("sample %d with %d threads: %d", k, nthreads, ret);
+	if (r.got != r.n)
+		FAIL("%d of %d records reported for k = %d", r.got, r.n, k);
+	free(offsets);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, t, ks[] = {1, 10, 1000, 20000};
+	seekgzip_t *sz = seekgzip_open(argv[1], 0);
+
+	ref = load_file(argv[2], &total);
+	delim = (unsigned char)argv[3][0];
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("open %s: %d", argv[1], seekgzip_error(sz));
+
+	for (i = 0;i < 4;++i)
+		for (t = 1;t <= 3;t += 2)
+			sample(sz, ks[i], 42 + i, t);
+
+	seekgzip_close(sz);
+	free(ref);
+	return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * set FILE FILE1.gz FILE2.gz FILE3.gz
+ *
+ * The gzip files hold consecutive pieces of FILE.  Opened as a set with at
+ * most one file open at a time, reads across file boundaries must return
+ * the bytes of FILE, and seekgzip_set_locate() must map offsets to files.
+ */
+
+#include <stdint.h>
+#include "seekgzip.h"
+#include "util.h"
+
+#define NUM_FILES 3
+
+int main(int argc, char *argv[])
+{
+	int i, n;
+	long total;
+	off_t offset, local, begin[NUM_FILES + 1];
+	char *ref = load_file(argv[1], &total), *buffer;
+	seekgzip_t *sz;
+	seekgzip_set_t *zset;
+
+	// Build the indexes and note where every file starts.
+	begin[0] = 0;
+	for (i = 0;i < NUM_FILES;++i) {
+		sz = seekgzip_open(argv[i + 2], 0);
+		if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+			FAIL("open %s: %d", argv[i + 2], seekgzip_error(sz));
+		begin[i + 1] = begin[i] + seekgzip_unpacked_length(sz);
+		seekgzip_close(sz);
+	}
+	if (begin[NUM_FILES] != total)
+		FAIL("the files hold %jd bytes, not %ld", (intmax_t)begin[NUM_FILES], total);
+
+	zset = seekgzip_set_open((const char**)argv + 2, NUM_FILES, 1, 0);
+	if (seekgzip_set_error(zset) != SEEKGZIP_SUCCESS)
+		FAIL("set open: %d", seekgzip_set_error(zset));
+	if (seekgzip_set_unpacked_length(zset) != total)
+		FAIL("set length %jd", (intmax_t)seekgzip_set_unpacked_length(zset));
+	if ((buffer = (char*)malloc(200000)) == NULL)
+		FAIL("out of memory");
+
+	for (i = 1;i <= NUM_FILES;++i) {
+		// Straddle the end of file i, or read up to the end of the set.
+		offset = begin[i] - 100000;
+		seekgzip_set_seek(zset, offset);
+		n = seekgzip_set_read(zset, buffer, 200000);
+		if (n != (i < NUM_FILES ? 200000 : 100000))
+			FAIL("read at %jd returned %d", (intmax_t)offset, n);
+		if (memcmp(buffer, ref + offset, n) != 0)
+			FAIL("wrong data at %jd", (intmax_t)offset);
+		if (seekgzip_set_tell(zset) != offset + n)
+			FAIL("tell after a read at %jd", (intmax_t)offset);
+
+		if (seekgzip_set_locate(zset, begin[i - 1], &local) != i - 1 || local != 0)
+			FAIL("locate %jd", (intmax_t)begin[i - 1]);
+		if (seekgzip_set_locate(zset, begin[i] - 1, &local) != i - 1 ||
+			local != begin[i] - begin[i - 1] - 1)
+			FAIL("locate %jd", (intmax_t)begin[i] - 1);
+	}
+	if (seekgzip_set_read(zset, buffer, 1) != 0)
+		FAIL("read past the end");
+
+	seekgzip_set_close(zset);
+	free(buffer);
+	free(ref);
+	return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ *		Helpers shared by the test programs.
+ */
+
+#ifndef __TESTS_UTIL_H__
+#define __TESTS_UTIL_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Read a whole file into memory; exits on failure. */
+static inline char *load_file(const char *path, long *size)
+{
+	char *data;
+	FILE *fp = fopen(path, "rb");
+
+	if (fp == NULL) {
+		fprintf(stderr, "FAIL: cannot open %s\n", path);
+		exit(1);
+	}
+	fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	rewind(fp);
+	if ((data = (char*)malloc(*size + 1)) == NULL ||
+		fread(data, 1, *size, fp) != (size_t)*size) {
+		fprintf(stderr, "FAIL: cannot read %s\n", path);
+		exit(1);
+	}
+	fclose(fp);
+	return data;
+}
+
+#define FAIL(...) do { fprintf(stderr, "FAIL: " __VA_ARGS__); fprintf(stderr, "\n"); exit(1); } while (0)
+
+#endif/*__TESTS_UTIL_H__*/
@@ -0,0 +1,62 @@
+/*
+ * verify FILE.gz
+ *
+ * FILE.gz holds incompressible data, so that its deflate blocks are stored
+ * and a flipped byte decodes without a zlib error.  Sequential reads with
+ * SEEKGZIP_VERIFY, with and without SEEKGZIP_READAHEAD, must succeed on
+ * the intact file and fail once a byte in the middle is flipped behind the
+ * back of a trusted index.
+ */
+
+#include <utime.h>
+#include <sys/stat.h>
+#include "seekgzip.h"
+#include "util.h"
+
+/* Read the whole file in pieces; returns the total or the first error. */
+static long read_all(const char *path, int flags)
+{
+	int n;
+	long total = 0;
+	char buffer[50000];
+	seekgzip_t *sz = seekgzip_open(path, flags);
+
+	if (seekgzip_error(sz) != SEEKGZIP_SUCCESS)
+		FAIL("open %s: %d", path, seekgzip_error(sz));
+	while ((n = seekgzip_read(sz, buffer, sizeof(buffer))) > 0)
+		total += n;
+	seekgzip_close(sz);
+	return n < 0 ? n : total;
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	long n, size;
+	FILE *fp;
+	struct stat st;
+	struct utimbuf times;
+
+	size = read_all(argv[1], SEEKGZIP_VERIFY);
+	if (size <= 0)
+		FAIL("verified read of the intact file: %ld", size);
+	if ((n = read_all(argv[1], SEEKGZIP_VERIFY | SEEKGZIP_READAHEAD)) != size)
+		FAIL("verified readahead of the intact file: %ld", n);
+
+	// Flip a byte and restore the modification time that the index trusts.
+	if (stat(argv[1], &st) != 0 || (fp = fopen(argv[1], "r+b")) == NULL)
+		FAIL("cannot open %s", argv[1]);
+	fseek(fp, st.st_size / 2, SEEK_SET);
+	c = fgetc(fp);
+	fseek(fp, st.st_size / 2, SEEK_SET);
+	fputc(c ^ 0x01, fp);
+	fclose(fp);
+	times.actime = times.modtime = st.st_mtime;
+	utime(argv[1], &times);
+
+	if ((n = read_all(argv[1], SEEKGZIP_VERIFY)) >= 0)
+		FAIL("verified read of the corrupted file returned %ld bytes", n);
+	if ((n = read_all(argv[1], SEEKGZIP_VERIFY | SEEKGZIP_READAHEAD)) >= 0)
+		FAIL("verified readahead of the corrupted file returned %ld bytes", n);
+	return 0;
+}